@@ -9,6 +9,7 @@
 #include "./co/sock.h"
 #include "./co/event.h"
 #include "./co/mutex.h"
+#include "./co/semaphore.h"
 #include "./co/pool.h"
 #include "./co/chan.h"
 #include "./co/io_event.h"
@@ -86,6 +87,71 @@ inline void go(F&& f, T* t, P&& p) {
     go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
 }
 
+/**
+ * add a batch of tasks, which will run as coroutines 
+ *   - It is thread-safe and can be called from anywhere. 
+ *   - Tasks are spread evenly across the schedulers. Each scheduler gets its 
+ *     part with a single atomic operation, and is woken up at most once. It is 
+ *     much cheaper than calling go() for each task when starting thousands of 
+ *     coroutines at a time.
+ *   - eg.
+ *     co::vector<Closure*> v;
+ *     for (int i = 0; i < 1000; ++i) v.push_back(new_closure(f, i));
+ *     co::go_batch(v);
+ *
+ * @param cbs  an array of Closure*, see go(Closure*) for details.
+ * @param n    number of the tasks.
+ */
+__coapi void go_batch(Closure* const* cbs, size_t n);
+
+inline void go_batch(const co::vector<Closure*>& cbs) {
+    go_batch(cbs.data(), cbs.size());
+}
+
+/**
+ * add a task, which will run as a coroutine with high priority 
+ *   - Each scheduler has two lanes for tasks ready to run, a high priority lane 
+ *     and a normal lane. A coroutine started by go_high() stays in the high 
+ *     priority lane until it ends. It is useful for latency-sensitive tasks, 
+ *     like request handlers, that share the schedulers with batch jobs.
+ *   - The high priority lane is always drained first. It is checked again 
+ *     after every 16 tasks in the normal lane, so the normal lane will not 
+ *     starve even if high priority tasks keep coming.
+ *   - High priority tasks are never stolen by other schedulers.
+ *   - The lanes only order new coroutines and those woken by other coroutines 
+ *     or threads (co::event, co::mutex, co::chan, co::resume()...). Coroutines 
+ *     woken by IO events or timers are resumed at once in the order they are 
+ *     found, before the lanes are checked, and high priority ones are not 
+ *     resumed ahead of others there.
+ *   - The parameters are the same as go(). 
+ */
+__coapi void go_high(Closure* cb);
+
+template<typename... X>
+inline void go_high(X&&... x) {
+    go_high(new_closure(std::forward<X>(x)...));
+}
+
+/**
+ * add a task, which will run as a coroutine on a dedicated stack 
+ *   - By default, coroutines in a scheduler share a few stacks, and the stack 
+ *     data is copied out when a coroutine is suspended, and copied back when 
+ *     it is resumed. It saves memory, but switching coroutines with a deep 
+ *     stack can be expensive.
+ *   - A dedicated stack is owned by the coroutine until it ends, no stack 
+ *     copying is needed. Memory of the stack is committed on demand, and its 
+ *     size is FLG_co_dedicated_stack_size.
+ *   - The parameters are the same as go(). 
+ *   - Set FLG_co_dedicated_stack to true to run all coroutines on dedicated 
+ *     stacks, or call Sched::set_dedicated_stack() for a single scheduler.
+ */
+__coapi void go_dedicated(Closure* cb);
+
+template<typename... X>
+inline void go_dedicated(X&&... x) {
+    go_dedicated(new_closure(std::forward<X>(x)...));
+}
+
 // define main function
 //   - make code in main function also runs in coroutine
 #define DEF_main(argc, argv) \
@@ -125,6 +191,52 @@ class __coapi Sched {
     inline void go(F&& f, T* t, P&& p) {
         this->go(new_closure(std::forward<F>(f), t, std::forward<P>(p)));
     }
+
+    // add a batch of tasks to this scheduler, see co::go_batch() for details
+    void go_batch(Closure* const* cbs, size_t n);
+
+    void go_batch(const co::vector<Closure*>& cbs) {
+        this->go_batch(cbs.data(), cbs.size());
+    }
+
+    // the same as go(), but the coroutine runs with high priority, see co::go_high()
+    void go_high(Closure* cb);
+
+    template<typename... X>
+    inline void go_high(X&&... x) {
+        this->go_high(new_closure(std::forward<X>(x)...));
+    }
+
+    // the same as go(), but the coroutine runs on a dedicated stack
+    void go_dedicated(Closure* cb);
+
+    template<typename... X>
+    inline void go_dedicated(X&&... x) {
+        this->go_dedicated(new_closure(std::forward<X>(x)...));
+    }
+
+    // run coroutines started later in this scheduler on dedicated stacks or not
+    //   - The default value is FLG_co_dedicated_stack.
+    //   - Coroutines already started are not affected.
+    void set_dedicated_stack(bool on);
+
+    // times this scheduler has stolen tasks from other schedulers
+    //   - Work stealing is disabled by default, set FLG_co_steal to true to enable it.
+    //   - Only tasks added by co::go() can be stolen, tasks added by Sched::go() 
+    //     always run in the scheduler they were added to.
+    uint64 steals() const;
+
+    // number of tasks this scheduler has stolen from other schedulers
+    uint64 stolen_tasks() const;
+
+    // times the stack data was copied in this scheduler
+    //   - Coroutines share a few stacks in a scheduler, the stack data of a 
+    //     coroutine is saved when another coroutine runs on the same stack, and 
+    //     restored when it is resumed. Dedicated stacks are never copied.
+    uint64 stack_copies() const;
+
+    // bytes of the stack data saved in this scheduler
+    uint64 stack_bytes() const;
 };
 
 class __coapi MainSched {
@@ -141,6 +253,37 @@ __coapi const co::vector<Sched*>& scheds();
 // get number of the schedulers
 __coapi int sched_num();
 
+// runtime statistics of a scheduler
+//   - Counters are accumulated since the scheduler started, take snapshots 
+//     periodically and compare them to get rates like switches per second.
+struct SchedStats {
+    uint32 id;             // id of the scheduler
+    uint32 coroutines;     // number of live coroutines
+    uint64 tasks;          // tasks found in the normal lane at the last check
+    uint64 switches;       // times of coroutine switches
+    uint64 stack_copies;   // times of stack copying, see Sched::stack_copies()
+    uint64 stack_saved;    // bytes of stack saved
+    uint64 stack_restored; // bytes of stack restored
+    uint64 timers;         // timers fired
+    uint64 wakeups;        // times the scheduler woke up after waiting in epoll
+    uint64 signals;        // signals received to wake up the scheduler
+    uint64 steals;         // times of stealing tasks from other schedulers
+    uint64 stolen_tasks;   // tasks stolen from other schedulers
+    int64 cputime;         // cpu time (us), counted only if there are multiple schedulers
+    uint64 spin_us;        // time (us) of busy polling, see FLG_co_busy_poll
+    uint64 sleep_us;       // time (us) of sleeping in epoll
+    uint64 high_tasks;     // tasks found in the high priority lane at the last check
+    uint64 high_switches;  // times of resuming coroutines in the high priority lane
+};
+
+// get a snapshot of the runtime statistics of all the schedulers
+//   - It can be called from any thread. Counters are updated by schedulers with 
+//     relaxed atomic stores, values of different counters may be inconsistent 
+//     with each other slightly.
+//   - e.g. 
+//     for (auto& s : co::sched_stats()) co::print(s.id, ": ", s.switches);
+__coapi co::vector<SchedStats> sched_stats();
+
 // get the current scheduler
 __coapi Sched* sched();
 
@@ -181,6 +324,10 @@ __coapi void add_timer(uint32 ms);
 //   - It MUST be called in coroutine.
 //   - Users MUST call yield() to suspend the coroutine after an event was added.
 //     When the event is present, the scheduler will resume the coroutine.
+//   - On linux, the socket stays in epoll (edge-triggered) until it is closed. 
+//     It is re-armed with EPOLL_CTL_MOD here if it is already in epoll, so the 
+//     coroutine is resumed at once if the event is already present, as with a 
+//     level-triggered epoll.
 // 
 //   - @fd: the socket.
 //   - @ev: either ev_read or ev_write.
@@ -202,6 +349,15 @@ __coapi void del_io_event(sock_t fd);
 //     or the timer expires, the scheduler will resume the coroutine. 
 __coapi void yield();
 
+// yield if the current coroutine has used up its time slice 
+//   - A coroutine runs until it yields, CPU-heavy code that never yields blocks 
+//     all other coroutines in the same scheduler. Call maybe_yield() in long 
+//     loops, the coroutine is put back to the ready queue and suspended, if it 
+//     has been running for more than FLG_co_time_slice (10 by default) ms since 
+//     it was resumed. It costs little more than reading the clock otherwise.
+//   - It does nothing if called from non-coroutines, or FLG_co_time_slice is 0.
+__coapi void maybe_yield();
+
 // resume the coroutine
 //   - It is thread safe and can be called anywhere.
 //   - @co: a pointer to the coroutine (result of co::coroutine())
@@ -1,9 +1,22 @@
 #pragma once
 
 #include "../def.h"
+#include "../god.h"
 #include <functional>
+#include <initializer_list>
 
 namespace co {
+namespace xx {
+class pipe;
+} // xx
+
+// a case of co::select(), see chan::read_case() and chan::write_case()
+struct select_case {
+    const xx::pipe* p;
+    void* x;
+    int op; // -1: read, 0: write (copy), 1: write (move)
+};
+
 namespace xx {
 
 class __coapi pipe {
@@ -24,14 +37,47 @@ class __coapi pipe {
 
     void read(void* p) const;
     void write(void* p, int o) const;
+    size_t read_n(void* p, size_t n) const;
+    size_t write_n(void* p, size_t n, int o) const;
     void close() const;
     bool is_closed() const;
     bool done() const;
+
+    // see co::select()
+    static int select(const select_case* cases, int n, uint32 ms);
   
   private:
     void* _p;
 };
 
+// Callbacks for copying and destructing elements of type T in the pipe. They 
+// are empty for trivially copyable types, the pipe copies them with memcpy.
+template<typename T, bool = god::is_trivially_copyable<T>()>
+struct pipe_ops {
+    static pipe::C c() {
+        return [](void* dst, void* src, int o) {
+            switch (o) {
+              case 0:
+                new (dst) T(*static_cast<const T*>(src));
+                break;
+              case 1:
+                new (dst) T(std::move(*static_cast<T*>(src)));
+                break;
+            }
+        };
+    }
+
+    static pipe::D d() {
+        return [](void* p){ static_cast<T*>(p)->~T(); };
+    }
+};
+
+template<typename T>
+struct pipe_ops<T, true> {
+    static pipe::C c() { return nullptr; }
+    static pipe::D d() { return nullptr; }
+};
+
 } // xx
 
 // Implement of channel in golang, it was improved a lot since v3.0.1:
@@ -44,20 +90,7 @@ class chan {
     // @cap  max capacity of the queue, 1 by default.
     // @ms   timeout in milliseconds, -1 by default.
     explicit chan(uint32 cap=1, uint32 ms=(uint32)-1)
-        : _p(cap * sizeof(T), sizeof(T), ms,
-          [](void* dst, void* src, int o) {
-              switch (o) {
-                case 0:
-                  new (dst) T(*static_cast<const T*>(src));
-                  break;
-                case 1:
-                  new (dst) T(std::move(*static_cast<T*>(src)));
-                  break;
-              }
-          },
-          [](void* p){
-              static_cast<T*>(p)->~T();
-          }) {
+        : _p(cap * sizeof(T), sizeof(T), ms, xx::pipe_ops<T>::c(), xx::pipe_ops<T>::d()) {
     }
 
     ~chan() = default;
@@ -84,6 +117,35 @@ class chan {
         return (chan&)*this;
     }
 
+    // Read up to @n elements to @x in a batch, wait only if the channel is 
+    // empty. Return the number of elements read, 0 on timeout or if the 
+    // channel was closed and empty.
+    size_t read_n(T* x, size_t n) const {
+        return _p.read_n((void*)x, n);
+    }
+
+    // Write @n elements in @x to the channel in a batch (copy constructor will 
+    // be used), wait when the channel is full. Return the number of elements 
+    // written, it is less than @n on timeout or if the channel was closed.
+    size_t write_n(const T* x, size_t n) const {
+        return _p.write_n((void*)x, n, 0);
+    }
+
+    // a case for co::select(), read an element to @x if it is chosen
+    select_case read_case(T& x) const {
+        return select_case{ &_p, (void*)&x, -1 };
+    }
+
+    // a case for co::select(), write @x to the channel if it is chosen
+    select_case write_case(const T& x) const {
+        return select_case{ &_p, (void*)&x, 0 };
+    }
+
+    // a case for co::select(), move @x to the channel if it is chosen
+    select_case write_case(T&& x) const {
+        return select_case{ &_p, (void*)&x, 1 };
+    }
+
     // return true if the read or write operation was done successfully
     bool done() const { return _p.done(); }
 
@@ -101,4 +163,32 @@ class chan {
 template<typename T>
 using Chan = chan<T>;
 
+/**
+ * wait for the first of several channel operations, like select in golang 
+ *   - If some of the operations can be done without waiting, one of them is 
+ *     chosen at random. Otherwise wait until one of them is done, only that 
+ *     one takes effect.
+ *   - A read on a closed and empty channel is done at once, done() of the 
+ *     channel returns false then. A write on a closed channel is the same.
+ *   - It can be used in coroutines and/or non-coroutines. No memory is allocated 
+ *     on each call, memory for waiting is cached in each thread.
+ *
+ *   co::chan<int> ch1, ch2;
+ *   int x;
+ *   switch (co::select({ ch1.read_case(x), ch2.write_case(3) }, 100)) {
+ *     case 0: // got x from ch1
+ *     case 1: // 3 was written to ch2
+ *     default: // timeout
+ *   }
+ *
+ * @param cases  cases created by chan::read_case() or chan::write_case(). The 
+ *               elements they refer to must be valid until select() returns.
+ * @param ms     timeout in milliseconds, -1 for never timeout, 0 for not waiting.
+ *
+ * @return  index of the case done, or -1 on timeout.
+ */
+inline int select(std::initializer_list<select_case> cases, uint32 ms=(uint32)-1) {
+    return xx::pipe::select(cases.begin(), (int)cases.size(), ms);
+}
+
 } // co
@@ -25,6 +25,8 @@ class __coapi io_event {
 
     // Wait until the IO event is present, or timed out, or any error occured.
     // Return false on error or timedout, call co::error() to get the error code.
+    // It SHOULD be called after the IO operation returned EAGAIN, as the socket 
+    // is registered to epoll in edge-triggered mode on linux.
     bool wait(uint32 ms=(uint32)-1);
 
   private:
@@ -5,6 +5,8 @@
 namespace co {
 
 // Mutex lock for coroutines, can be also used in non-coroutines since v3.0.1.
+// It spins for a short while before the caller is parked if the lock is held 
+// in another scheduler or thread, see FLG_co_mutex_spin.
 class __coapi mutex {
   public:
     mutex();
@@ -46,6 +48,84 @@ class __coapi mutex_guard {
     DISALLOW_COPY_AND_ASSIGN(mutex_guard);
 };
 
+// Read-write lock for coroutines, it can be also used in non-coroutines. 
+//   - Readers and writers that can not get the lock are parked, coroutines 
+//     waiting do not block their scheduler threads.
+//   - If nobody is waiting, readers get and release the lock with a single 
+//     atomic operation.
+//   - Waiters get the lock in FIFO order. Once a writer is waiting, readers 
+//     coming later wait behind it, and readers waiting in a row are granted 
+//     the lock together, so neither readers nor writers will starve.
+class __coapi rwmutex {
+  public:
+    rwmutex();
+    ~rwmutex();
+
+    rwmutex(rwmutex&& m) noexcept : _p(m._p) { m._p = 0; }
+
+    // copy constructor, just increment the reference count
+    rwmutex(const rwmutex& m);
+
+    void operator=(const rwmutex&) = delete;
+
+    // lock for writing
+    void lock() const;
+
+    void unlock() const;
+
+    bool try_lock() const;
+
+    // lock for reading
+    void lock_shared() const;
+
+    void unlock_shared() const;
+
+    bool try_lock_shared() const;
+
+  private:
+    void* _p;
+};
+
+// guard of rwmutex for reading
+class __coapi shared_lock {
+  public:
+    explicit shared_lock(const co::rwmutex& m) : _m(m) {
+        _m.lock_shared();
+    }
+
+    explicit shared_lock(const co::rwmutex* m) : _m(*m) {
+        _m.lock_shared();
+    }
+
+    ~shared_lock() {
+        _m.unlock_shared();
+    }
+
+  private:
+    const co::rwmutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(shared_lock);
+};
+
+// guard of rwmutex for writing
+class __coapi unique_lock {
+  public:
+    explicit unique_lock(const co::rwmutex& m) : _m(m) {
+        _m.lock();
+    }
+
+    explicit unique_lock(const co::rwmutex* m) : _m(*m) {
+        _m.lock();
+    }
+
+    ~unique_lock() {
+        _m.unlock();
+    }
+
+  private:
+    const co::rwmutex& _m;
+    DISALLOW_COPY_AND_ASSIGN(unique_lock);
+};
+
 typedef mutex Mutex;
 typedef mutex_guard MutexGuard;
 
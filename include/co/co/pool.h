@@ -5,6 +5,16 @@
 
 namespace co {
 
+// statistics of co::pool, summed over all the schedulers
+struct pool_stats {
+    uint64 hits;    // elements popped from the pool, including borrows
+    uint64 borrows; // elements popped from the shared pool
+    uint64 misses;  // times pop() found no element in the pool
+    uint64 creates; // elements created by ccb
+    uint64 evicts;  // elements destroyed as they were idle for too long
+    uint64 drops;   // elements destroyed as they failed the health check
+};
+
 /**
  * a general pool for coroutine programming
  *   - It is designed to be coroutine-safe, users do not need to lock it.
@@ -14,6 +24,9 @@ namespace co {
  * 
  *   - NOTE: Each thread holds its own pool, users SHOULD call pop() and push() 
  *     in the same thread.
+ *   - A shared pool can be enabled with set_shared_cap(). Elements beyond the 
+ *     share of a thread go there, and threads with an empty pool borrow 
+ *     elements from it.
  */
 class __coapi pool {
   public:
@@ -71,6 +84,44 @@ class __coapi pool {
      */
     void clear() const;
 
+    /**
+     * set capacity of the shared pool, 0 by default (disabled) 
+     *   - It SHOULD be called before the pool is used.
+     *   - A thread keeps at most cap / sched_num() elements (or the capacity 
+     *     of the pool if it is smaller) in its own pool. push() puts elements 
+     *     beyond that to the shared pool, or keeps them in the pool of the 
+     *     thread if the shared pool is full. pop() borrows an element from 
+     *     the shared pool before it creates a new one.
+     *   - dcb is not called with the shared pool locked.
+     */
+    void set_shared_cap(size_t cap) const;
+
+    /**
+     * set the idle timeout of elements, 0 by default (never timeout) 
+     *   - It SHOULD be called before the pool is used, and dcb MUST be set.
+     *   - Elements idle in the pool for more than @ms milliseconds are destroyed 
+     *     by dcb. The pool of a thread is checked in push() and pop(), call 
+     *     evict() to check pools of all threads.
+     */
+    void set_idle_timeout(uint32 ms) const;
+
+    /**
+     * set a health check callback like:  [](void* p) { return ((T*)p)->ok(); }
+     *   - It SHOULD be called before the pool is used.
+     *   - pop() checks an element before it is returned, elements that fail 
+     *     the check are destroyed by dcb.
+     */
+    void set_health_check(std::function<bool(void*)>&& hcb) const;
+
+    /**
+     * destroy elements idle for too long in pools of all threads 
+     *   - It can be called from any where, see set_idle_timeout().
+     */
+    void evict() const;
+
+    // get statistics of the pool
+    pool_stats stats() const;
+
   private:
     void* _p;
 };
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../def.h"
+
+namespace co {
+
+// Counting semaphore for coroutines, it can be also used in non-coroutines. 
+//   - Permits are taken with a single CAS if they are available and nobody 
+//     is waiting, otherwise the caller waits.
+//   - Waiters get permits in FIFO order, a waiter asking for many permits 
+//     will not be starved by those asking for less.
+class __coapi semaphore {
+  public:
+    // @n  number of permits available at the beginning
+    explicit semaphore(uint32 n=0);
+    ~semaphore();
+
+    semaphore(semaphore&& s) noexcept : _p(s._p) {
+        s._p = 0;
+    }
+
+    // copy constructor, just increment the reference count
+    semaphore(const semaphore& s);
+
+    void operator=(const semaphore&) = delete;
+
+    // acquire @n permits, wait until they are available
+    void acquire(uint32 n=1) const {
+        (void) this->acquire(n, (uint32)-1);
+    }
+
+    // Acquire @n permits, wait for at most @ms milliseconds. 
+    // Return true if the permits are acquired, or false on timeout.
+    bool acquire(uint32 n, uint32 ms) const;
+
+    // acquire @n permits without waiting, return false if they are not available
+    bool try_acquire(uint32 n=1) const {
+        return this->acquire(n, 0);
+    }
+
+    // release @n permits, waiters are woken up if their permits are available
+    void release(uint32 n=1) const;
+
+    // number of permits available now
+    uint32 available() const;
+
+  private:
+    void* _p;
+};
+
+// Acquire permits in the constructor and release them in the destructor, 
+// it can be used to limit the number of concurrent requests, e.g.
+//
+//   co::semaphore sem(8);
+//   go([sem]() {
+//       co::semaphore_guard g(sem); // at most 8 coroutines do the request
+//       do_request();
+//   });
+class __coapi semaphore_guard {
+  public:
+    explicit semaphore_guard(const co::semaphore& s, uint32 n=1) : _s(s), _n(n) {
+        _s.acquire(_n);
+    }
+
+    explicit semaphore_guard(const co::semaphore* s, uint32 n=1) : _s(*s), _n(n) {
+        _s.acquire(_n);
+    }
+
+    ~semaphore_guard() {
+        _s.release(_n);
+    }
+
+  private:
+    const co::semaphore& _s;
+    const uint32 _n;
+    DISALLOW_COPY_AND_ASSIGN(semaphore_guard);
+};
+
+typedef semaphore Semaphore;
+
+} // co
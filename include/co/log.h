@@ -52,6 +52,24 @@ __coapi void set_write_cb(const std::function<void(const void*, size_t)>& cb, in
  */
 __coapi void set_write_cb(const std::function<void(const char*, const void*, size_t)>& cb, int flags=0);
 
+/**
+ * get stack trace of a thread
+ *   - It is used by the coroutine schedulers to report a scheduler thread blocked 
+ *     by a coroutine. On windows, the thread is suspended. On unix, the thread 
+ *     is interrupted by the signal FLG_log_trace_signal (SIGRTMAX-1 on linux by 
+ *     default), and the handler saves return addresses without allocating memory. 
+ *     The handler is installed on the first call, but not if the application 
+ *     already has a handler for that signal, and then it always returns false.
+ *   - On unix, symbols come from backtrace_symbols(), it needs glibc or macOS, 
+ *     and -rdynamic for names of functions in the executable.
+ *
+ * @param tid  id of the thread, see co::thread_id().
+ * @param s    the stack trace will be appended to it.
+ *
+ * @return  true on success, false on error or if the thread does not respond in 1s.
+ */
+__coapi bool stack_trace(uint32 tid, fastream& s);
+
 namespace xx {
 
 struct __coapi Initializer {
@@ -12,6 +12,8 @@
 #include <type_traits>
 #include <functional>
 
+class fastring;
+
 namespace co {
 namespace xx {
 
@@ -51,6 +53,47 @@ __coapi void* try_realloc(void* p, size_t old_size, size_t new_size);
 
 __coapi char* strdup(const char* s);
 
+// memory stats of a thread-local allocator, or of the whole process
+//   - Sizes are in bytes, allocations are rounded up to 16 bytes (<= 2K) or 
+//     4K (<= 128K). Allocations larger than 128K are passed to ::malloc.
+//   - reserved, retained, xfree_pending, sys_allocs and sys_in_use are global, 
+//     they are 0 for threads.
+//   - Memory freed by another thread is counted by the thread that frees it, 
+//     and subtracted only from the process totals. small_in_use and large_in_use 
+//     of a thread do not drop when other threads free its memory.
+struct mem_stat {
+    size_t reserved;      // address space reserved by huge blocks
+    size_t committed;     // memory committed by large blocks (2M, or 1M on arch32)
+    size_t retained;      // free large blocks kept committed for reuse
+    size_t in_use;        // small_in_use + large_in_use + sys_in_use
+    size_t small_blocks;  // number of small blocks (32K) for allocations <= 2K
+    size_t small_in_use;  // bytes in use in small blocks
+    size_t large_blocks;  // number of large blocks for allocations <= 128K
+    size_t large_in_use;  // bytes in use in large blocks
+    size_t xfree_pending; // frees from other threads not yet reclaimed
+    size_t sys_allocs;    // number of allocations passed to ::malloc
+    size_t sys_in_use;    // bytes in use allocated by ::malloc
+};
+
+// Get memory stats of the process.
+//   - If @f is not empty, it will be called with the id and stats of each 
+//     thread-local allocator.
+//   - Values are read without locking, they are approximate while other 
+//     threads are allocating.
+__coapi mem_stat mem_stats(
+    const std::function<void(uint32 id, const mem_stat& s)>& f=nullptr
+);
+
+// Return free large blocks idle for more than FLG_mem_decay_ms to the OS.
+//   - It is also done when large blocks are freed, and every second by a 
+//     background thread started when a free block is retained the first time.
+//   - FLG_mem_max_retained caps the size of free blocks retained.
+__coapi void mem_scavenge();
+
+// dump memory stats as a JSON string, including stats of all threads
+//   - eg. {"reserved":134217728,...,"threads":[{"id":0,...}]}
+__coapi fastring mem_stats_json();
+
 // alloc memory and construct an object on it
 //   - T* p = co::make<T>(args)
 template<typename T, typename... Args>
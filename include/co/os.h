@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fastring.h"
+#include "vector.h"
 #include <signal.h>
 
 namespace os {
@@ -44,6 +45,28 @@ __coapi int cpunum();
 // get size of a page in bytes
 __coapi size_t pagesize();
 
+// topology of a logical processor
+struct cpu_t {
+    int id;   // id of the logical processor
+    int core; // id of the physical core, SMT siblings have the same core id
+    int node; // id of the NUMA node
+};
+
+// get topology of the online logical processors, sorted by id
+//   - Core ids are numbered from 0 in the order they are found.
+//   - Where the topology is not available, each processor is treated as a 
+//     single core on node 0.
+__coapi const co::vector<cpu_t>& cpus();
+
+// get number of the NUMA nodes
+__coapi int numa_nodes();
+
+// Bind the current thread to the logical processor @cpu. 
+//   - On linux, memory will be allocated from the NUMA node of the processor 
+//     when it is first touched by the thread.
+//   - Return false on error or if it is not supported.
+__coapi bool bind_cpu(int cpu);
+
 // run as a daemon
 __coapi void daemon();
 
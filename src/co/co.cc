@@ -1,5 +1,7 @@
 #include "sched.h"
 #include "co/stl.h"
+#include "co/rand.h"
+#include "co/os.h"
 
 #ifndef _WIN32
 #ifdef __linux__
@@ -163,6 +165,9 @@ class mutex_impl {
         size_t size() const noexcept { return _m ? _m->size : 0; }
         bool empty() const noexcept { return this->size() == 0; }
 
+        // the first element, the queue MUST not be empty
+        void* front() const noexcept { return _m->q[_m->rx]; }
+
         void push_back(void* x) {
             _memb* m = (_memb*) _q.back();
             if (!m || m->wx == N) {
@@ -196,74 +201,271 @@ class mutex_impl {
         };
     };
 
-    mutex_impl() : _refn(1), _lock(0), _has_cv(false) {}
+    static const uint8 L = 1; // locked
+    static const uint8 K = 2; // someone is waiting
+
+    mutex_impl() : _s(0), _spins(0), _owner(0), _refn(1), _tn(0), _has_cv(false) {}
     ~mutex_impl() { if (_has_cv) xx::cv_free(&_cv); }
 
     void lock();
     void unlock();
-    bool try_lock();
+    bool try_lock() { return atomic_bool_cas(&_s, 0, L, mo_acquire, mo_relaxed); }
 
     void ref() { atomic_inc(&_refn, mo_relaxed); }
     uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
 
   private:
+    // Spin for a while before waiting in the queue, return true if the lock 
+    // is got. The limit is adapted to the number of spins it took to get the 
+    // lock recently, which follows how long the lock is held. It does not spin 
+    // on a single cpu, or if the lock is held in the same scheduler (thread).
+    bool _spin(void* me);
+
+    // wait in the queue, the lock will be handed over to this waiter
+    void _lock_slow(Sched* sched);
+
+  private:
+    uint8 _s;     // bit 0: locked, bit 1: someone is waiting
+    int32 _spins; // average number of spins to get the lock
+    void* _owner; // scheduler or thread that got the lock at last
     xx::mutex _m;
     xx::cv_t _cv;
     queue _wq;
     uint32 _refn;
-    uint8 _lock;
+    uint32 _tn;   // number of threads the lock was handed over to
     bool _has_cv;
 };
 
-inline bool mutex_impl::try_lock() {
-    xx::mutex_guard g(_m);
-    return _lock ? false : (_lock = 1);
+inline void cpu_relax() {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
 }
 
-void mutex_impl::lock() {
-    const auto sched = xx::gSched;
-    if (sched) { /* in coroutine */
-        _m.lock();
-        if (!_lock) {
-            _lock = 1;
-            _m.unlock();
-        } else {
-            Coroutine* const co = sched->running();
-            _wq.push_back(co);
-            _m.unlock();
-            sched->yield();
+static const bool g_multicore = os::cpunum() > 1;
+
+bool mutex_impl::_spin(void* me) {
+    if (!g_multicore || FLG_co_mutex_spin == 0) return false;
+    if (atomic_load(&_owner, mo_relaxed) == me) return false; // the owner can not run
+
+    const int32 spins = atomic_load(&_spins, mo_relaxed);
+    const int32 lim = (int32)FLG_co_mutex_spin;
+    const int32 max = spins * 2 + 10 < lim ? spins * 2 + 10 : lim;
+    bool r = false;
+    int32 n = 0;
+    for (; n < max; ++n) {
+        const uint8 s = atomic_load(&_s, mo_relaxed);
+        if (s == 0) {
+            if (atomic_bool_cas(&_s, 0, L, mo_acquire, mo_relaxed)) { r = true; break; }
+        } else if (s != L) {
+            break; // someone is waiting, the lock will be handed over to it
+        }
+        cpu_relax();
+    }
+    atomic_store(&_spins, spins + (n - spins) / 8, mo_relaxed);
+    return r;
+}
+
+void mutex_impl::_lock_slow(Sched* sched) {
+    _m.lock();
+    uint8 s = atomic_load(&_s, mo_relaxed);
+    for (;;) {
+        const uint8 v = (s & L) ? (s | K) : (s | L);
+        const uint8 x = atomic_cas(&_s, s, v, mo_acquire, mo_relaxed);
+        if (x == s) {
+            if (!(s & L)) { _m.unlock(); return; }
+            break;
         }
+        s = x;
+    }
 
+    if (sched) { /* in coroutine */
+        _wq.push_back(sched->running());
+        _m.unlock();
+        sched->yield();
     } else { /* non-coroutine */
-        xx::mutex_guard g(_m);
-        if (!_lock) {
-            _lock = 1;
-        } else {
-            _wq.push_back(nullptr);
-            if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
-            for (;;) {
-                xx::cv_wait(&_cv, _m.native_handle());
-                if (_lock == 2) { _lock = 1; break; }
-            }
-        }
+        _wq.push_back(nullptr);
+        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        while (_tn == 0) xx::cv_wait(&_cv, _m.native_handle());
+        --_tn;
+        _m.unlock();
     }
 }
 
+void mutex_impl::lock() {
+    const auto sched = xx::gSched;
+    void* const me = sched ? (void*)sched : (void*)&g_tid;
+    if (!this->try_lock() && !this->_spin(me)) this->_lock_slow(sched);
+    atomic_store(&_owner, me, mo_relaxed);
+}
+
 void mutex_impl::unlock() {
+    if (atomic_bool_cas(&_s, L, 0, mo_release, mo_relaxed)) return;
+
+    // someone is waiting, hand over the lock to the first one
     _m.lock();
-    if (_wq.empty()) {
-        _lock = 0;
+    Coroutine* const co = (Coroutine*) _wq.pop_front();
+    if (_wq.empty()) atomic_store(&_s, L, mo_relaxed);
+    if (co) {
         _m.unlock();
+        co->sched->add_ready_task(co);
     } else {
-        Coroutine* const co = (Coroutine*) _wq.pop_front();
+        ++_tn;
+        _m.unlock();
+        xx::cv_notify_one(&_cv);
+    }
+}
+
+// The state of the rwmutex is a single word, the writer bit, the waiting bit and 
+// the number of readers. The waiting bit is set, with the mutex locked, while 
+// the queue is not empty. Readers and writers take the fast path only if it is 
+// not set, and the lock is handed over to the waiters in order.
+class rwmutex_impl {
+  public:
+    static const uint32 W = 1u << 31; // locked by a writer
+    static const uint32 K = 1u << 30; // someone is waiting
+    static const uint32 R = K - 1;    // mask of the number of readers
+
+    rwmutex_impl() : _s(0), _refn(1), _rn(0), _wn(0), _has_cv(false) {}
+    ~rwmutex_impl() {
+        if (_has_cv) { xx::cv_free(&_rcv); xx::cv_free(&_wcv); }
+    }
+
+    void lock() {
+        if (!atomic_bool_cas(&_s, 0, W, mo_acquire, mo_relaxed)) this->_lock_slow(false);
+    }
+
+    void unlock();
+
+    bool try_lock() {
+        return atomic_bool_cas(&_s, 0, W, mo_acquire, mo_relaxed);
+    }
+
+    void lock_shared() {
+        if (!this->try_lock_shared()) this->_lock_slow(true);
+    }
+
+    void unlock_shared();
+
+    bool try_lock_shared() {
+        uint32 s = atomic_load(&_s, mo_relaxed);
+        while (!(s & (W | K))) {
+            const uint32 x = atomic_cas(&_s, s, s + 1, mo_acquire, mo_relaxed);
+            if (x == s) return true;
+            s = x;
+        }
+        return false;
+    }
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+  private:
+    // Get the lock or wait in the queue until the lock is handed over. Waiters 
+    // are stored as pointers of coroutines (NULL for threads), with the lowest 
+    // bit set for readers.
+    void _lock_slow(bool rd);
+
+    // Hand over the lock to the first writer, or the readers in a row at the 
+    // front of the queue. It MUST be called with the mutex locked, when the 
+    // lock is released and the waiting bit is set.
+    void _handover();
+
+    void _wake(void* x) {
+        Coroutine* const co = (Coroutine*)((size_t)x & ~(size_t)1);
         if (co) {
-            _m.unlock();
             co->sched->add_ready_task(co);
+        } else if ((size_t)x & 1) {
+            ++_rn;
+            xx::cv_notify_one(&_rcv);
         } else {
-            _lock = 2;
-            _m.unlock();
-            xx::cv_notify_one(&_cv);
+            ++_wn;
+            xx::cv_notify_one(&_wcv);
+        }
+    }
+
+  private:
+    uint32 _s;
+    uint32 _refn;
+    xx::mutex _m;
+    mutex_impl::queue _wq;
+    xx::cv_t _rcv;
+    xx::cv_t _wcv;
+    uint32 _rn; // number of reader threads the lock was handed over to
+    uint32 _wn; // number of writer threads the lock was handed over to
+    bool _has_cv;
+};
+
+void rwmutex_impl::_lock_slow(bool rd) {
+    const auto sched = xx::gSched;
+    _m.lock();
+    uint32 s = atomic_load(&_s, mo_relaxed);
+    for (;;) {
+        if (s & K) break;
+        const bool ok = rd ? !(s & W) : s == 0;
+        const uint32 v = ok ? (rd ? s + 1 : W) : (s | K);
+        const uint32 x = atomic_cas(&_s, s, v, mo_acquire, mo_relaxed);
+        if (x == s) {
+            if (ok) { _m.unlock(); return; }
+            break;
+        }
+        s = x;
+    }
+
+    Coroutine* const co = sched ? sched->running() : 0;
+    _wq.push_back((void*)((size_t)co | (size_t)rd));
+    if (co) {
+        _m.unlock();
+        sched->yield();
+    } else {
+        if (!_has_cv) {
+            xx::cv_init(&_rcv);
+            xx::cv_init(&_wcv);
+            _has_cv = true;
         }
+        uint32& n = rd ? _rn : _wn;
+        while (n == 0) xx::cv_wait(rd ? &_rcv : &_wcv, _m.native_handle());
+        --n;
+        _m.unlock();
+    }
+}
+
+void rwmutex_impl::_handover() {
+    void* x = _wq.pop_front();
+    if (!((size_t)x & 1)) { /* writer */
+        atomic_store(&_s, _wq.empty() ? W : (W | K), mo_release);
+        this->_wake(x);
+        return;
+    }
+
+    // A reader woken up may release the lock before the others are counted, 
+    // so unlock_shared() checks the state again with the mutex locked before 
+    // it hands over the lock.
+    atomic_store(&_s, K + 1, mo_release);
+    this->_wake(x);
+    while (!_wq.empty() && ((size_t)_wq.front() & 1)) {
+        x = _wq.pop_front();
+        atomic_inc(&_s, mo_relaxed);
+        this->_wake(x);
+    }
+    if (_wq.empty()) atomic_and(&_s, ~K, mo_relaxed);
+}
+
+void rwmutex_impl::unlock() {
+    if (atomic_bool_cas(&_s, W, 0, mo_release, mo_relaxed)) return;
+    xx::mutex_guard g(_m);
+    this->_handover(); // the state is W | K
+}
+
+void rwmutex_impl::unlock_shared() {
+    const uint32 s = atomic_fetch_dec(&_s, mo_acq_rel);
+    if ((s & K) && (s & R) == 1) {
+        xx::mutex_guard g(_m);
+        if (atomic_load(&_s, mo_relaxed) == K) this->_handover();
     }
 }
 
@@ -399,6 +601,153 @@ inline void event_impl::reset() {
     _signaled = false;
 }
 
+// Permits are kept in an atomic counter. A waiter is counted in _nw before it 
+// checks the counter again with the mutex locked, and release() checks _nw 
+// after it adds the permits, at least one of them will see the other.
+class semaphore_impl {
+  public:
+    explicit semaphore_impl(uint32 n) : _n(n), _nw(0), _refn(1), _has_cv(false) {}
+    ~semaphore_impl() { if (_has_cv) xx::cv_free(&_cv); }
+
+    bool acquire(uint32 n, uint32 ms);
+    void release(uint32 n);
+    uint32 available() const { return atomic_load(&_n, mo_relaxed); }
+
+    void ref() { atomic_inc(&_refn, mo_relaxed); }
+    uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
+
+    struct waitx : waitx_t {
+        uint32 n; // number of permits wanted
+    };
+
+  private:
+    // take @n permits if they are available
+    bool _take(uint32 n) {
+        uint32 s = atomic_load(&_n);
+        while (s >= n) {
+            const uint32 x = atomic_cas(&_n, s, s - n, mo_acquire, mo_relaxed);
+            if (x == s) return true;
+            s = x;
+        }
+        return false;
+    }
+
+    // Give permits to the waiters in order, until the first one that can not 
+    // get its permits. Waiters timed out are skipped, they remove themselves 
+    // from the queue. It MUST be called with the mutex locked. 
+    void _grant(waitx* self);
+
+    void _unlink(waitx* w) {
+        _wq.erase(w);
+        atomic_store(&_nw, _nw - 1, mo_relaxed);
+    }
+
+  private:
+    uint32 _n;  // number of permits available
+    uint32 _nw; // number of waiters, written only with the mutex locked
+    uint32 _refn;
+    bool _has_cv;
+    xx::mutex _m;
+    xx::cv_t _cv;
+    co::clist _wq;
+};
+
+void semaphore_impl::_grant(waitx* self) {
+    waitx* next;
+    for (waitx* w = (waitx*) _wq.front(); w; w = next) {
+        next = (waitx*) w->next;
+        if (atomic_load(&w->state, mo_relaxed) == st_timeout) continue;
+        if (!this->_take(w->n)) break;
+        if (!atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+            atomic_fetch_add(&_n, w->n, mo_relaxed); /* timeout */
+            continue;
+        }
+        this->_unlink(w);
+        if (w == self) continue;
+        w->co ? w->co->sched->add_ready_task(w->co) : xx::cv_notify_all(&_cv);
+    }
+}
+
+bool semaphore_impl::acquire(uint32 n, uint32 ms) {
+    // fast path, nobody is waiting
+    if (atomic_load(&_nw, mo_relaxed) == 0 && this->_take(n)) return true;
+
+    const auto sched = gSched;
+    _m.lock();
+    this->_grant(0);
+    if (_wq.empty() && this->_take(n)) { _m.unlock(); return true; }
+    if (ms == 0) { _m.unlock(); return false; }
+
+    Coroutine* const co = sched ? sched->running() : 0;
+    waitx* w;
+    waitx x;
+    if (co) {
+        w = (waitx*) make_waitx(co, sizeof(waitx));
+    } else {
+        w = &x;
+        w->next = w->prev = 0;
+        w->co = 0;
+        w->state = st_wait;
+    }
+    w->n = n;
+    _wq.push_back(w);
+    atomic_store(&_nw, _nw + 1);
+
+    // permits may be released before the waiter is counted
+    this->_grant(w);
+    if (w->state == st_ready) {
+        _m.unlock();
+        if (co) co::free(w, sizeof(waitx));
+        return true;
+    }
+
+    if (co) {
+        _m.unlock();
+        co->waitx = w;
+        if (ms != (uint32)-1) sched->add_timer(ms);
+        sched->yield();
+        co->waitx = 0;
+        const bool timeout = sched->timeout();
+        if (timeout) {
+            xx::mutex_guard g(_m);
+            this->_unlink(w);
+            // the permits released may be enough for those after it
+            if (atomic_load(&_n, mo_relaxed) > 0) this->_grant(0);
+        }
+        co::free(w, sizeof(waitx));
+        return !timeout;
+    }
+
+    if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+    const int64 deadline = ms != (uint32)-1 ? now::ms() + ms : 0;
+    while (w->state == st_wait) {
+        if (ms == (uint32)-1) {
+            xx::cv_wait(&_cv, _m.native_handle());
+            continue;
+        }
+        const int64 t = deadline - now::ms();
+        if (t <= 0 || !xx::cv_wait(&_cv, _m.native_handle(), (uint32)t)) {
+            if (w->state != st_wait) break;
+            if (now::ms() < deadline) continue;
+            w->state = st_timeout;
+            this->_unlink(w);
+            if (atomic_load(&_n, mo_relaxed) > 0) this->_grant(0);
+            _m.unlock();
+            return false;
+        }
+    }
+    _m.unlock();
+    return true;
+}
+
+void semaphore_impl::release(uint32 n) {
+    atomic_fetch_add(&_n, n);
+    if (atomic_load(&_nw) > 0) {
+        xx::mutex_guard g(_m);
+        this->_grant(0);
+    }
+}
+
 class sync_event_impl {
   public:
     explicit sync_event_impl(bool m, bool s)
@@ -463,21 +812,45 @@ class sync_event_impl {
 
 __thread bool g_done = false;
 
+// Waiting context of co::select(), shared by the waiters of all its cases. A 
+// case is chosen by changing the state from st_wait to st_ready, so only one 
+// of them can be done. A pipe may hold the state st_busy while it tries a case, 
+// and set it back to st_wait if the case can not be done.
+struct select_waitx : waitx_t {
+    void* winner;       // the waiter chosen
+    co::sync_event* ev; // to wake up a thread
+    bool self;          // done by the select itself before it waits
+};
+
 class pipe_impl {
   public:
     pipe_impl(uint32 buf_size, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d)
-        : _buf_size(buf_size), _blk_size(blk_size), _ms(ms), _has_cv(false),
-          _c(std::move(c)), _d(std::move(d)), _rx(0), _wx(0), _refn(1), _full(0), _closed(0) {
+        : _blk_size(blk_size), _cap(buf_size > blk_size ? buf_size / blk_size : 1), _ms(ms),
+          _pod(!c), _has_cv(false), _c(std::move(c)), _d(std::move(d)), _nw(0), _refn(1), _closed(0) {
+        _buf_size = _cap * _blk_size;
+        _pow2 = (_cap & (_cap - 1)) == 0;
         _buf = (char*) co::alloc(_buf_size);
+        _seq = (uint64*) co::alloc(_cap * sizeof(uint64));
+        for (uint32 i = 0; i < _cap; ++i) _seq[i] = (uint64)i << 1;
+        _head = 0;
+        _tail = 0;
     }
 
     ~pipe_impl() {
+        // waiters timed out are removed from the queue lazily, free the rest
+        while (!_wq.empty()) {
+            waitx* const w = (waitx*) _wq.pop_front();
+            this->_drop(w);
+        }
+        co::free(_seq, _cap * sizeof(uint64));
         co::free(_buf, _buf_size);
         if (_has_cv) xx::cv_free(&_cv);
     }
 
     void read(void* p);
     void write(void* p, int v);
+    size_t read_n(void* p, size_t n);
+    size_t write_n(void* p, size_t n, int v);
     bool done() const { return g_done; }
     void close();
     bool is_closed() const { return atomic_load(&_closed, mo_relaxed); }
@@ -492,17 +865,20 @@ class pipe_impl {
             struct {
                 uint8 state;
                 uint8 done; // 1: ok, 2: channel closed
-                uint8 v; // 0: cp, 1: mv, 2: need destruct the object in buf
+                uint8 v;    // 0: cp, 1: mv, 2: need destruct the object in buf
+                uint8 rd;   // 1: wait for read, 0: wait for write
+                uint8 linked; // in the wait queue (select only)
             } x;
             void* dummy;
         };
         void* buf;
-        size_t len; // total length of the memory
+        size_t len;      // total length of the memory
+        select_waitx* g; // the select it belongs to, or NULL
     };
 
     waitx* create_waitx(Coroutine* co, void* buf) {
         waitx* w;
-        if (co && gSched->on_stack(buf)) {
+        if (co && gSched->on_shared_stack(buf)) {
             w = (waitx*) co::alloc(sizeof(waitx) + _blk_size);
             w->buf = (char*)w + sizeof(waitx);
             w->len = sizeof(waitx) + _blk_size;
@@ -514,18 +890,172 @@ class pipe_impl {
         w->co = co;
         w->state = st_wait;
         w->x.done = 0;
+        w->g = 0;
         return w;
     }
 
+    // For co::select(), they return 1 if the operation is done, 2 if the 
+    // channel is closed, or 0 if it would block.
+    int try_read(void* p);
+    int try_write(void* p, int v);
+
+    uint32 blk_size() const { return _blk_size; }
+
+    // Init a waiter for a case of co::select(). @op is -1 for read, 0 or 1 for 
+    // write (copy or move). If @buf is not NULL, @x is on a shared stack, the 
+    // element is kept in @buf while waiting.
+    void init_waiter(waitx* w, select_waitx* g, void* x, int op, void* buf);
+
+    // add the waiter to the queue, if no case of the select has been chosen
+    void add_waiter(waitx* w);
+
+    // Remove the waiter from the queue if it is still there, and move the 
+    // element read to @x if it is chosen.
+    void del_waiter(waitx* w, void* x);
+
   private:
-    void _read_block(void* p);
-    void _write_block(void* p, int v);
+    // copy (v == 0) or move (v == 1) an element from @src to @dst, elements of 
+    // trivially copyable types are copied with memcpy
+    void _copy(void* dst, void* src, int v) {
+        _pod ? (void) memcpy(dst, src, _blk_size) : _c(dst, src, v);
+    }
+
+    void _destroy(void* p) {
+        if (!_pod) _d(p);
+    }
+
+    // The buffer is a bounded MPMC ring, each slot has a sequence number. It is 
+    // 2 * pos when the slot is empty for the position, or 2 * pos + 1 when an 
+    // element is in it. Push and pop are lock-free.
+    //   - The sequence number is updated with a seq_cst store. A fast path reader 
+    //     or writer checks the number of waiters after it, and a waiter checks 
+    //     the ring after it is counted, at least one of them will see the other.
+    //   - _push() returns false if the ring is full.
+    //   - _pop() returns false if the ring is empty. If @dtor is true, the object 
+    //     in @p will be destructed before the element is moved to it.
+    bool _push(void* p, int v);
+    bool _pop(void* p, bool dtor);
+
+    // Push (pop) up to @n elements, slots in a row are claimed with a single 
+    // CAS. Return the number of elements pushed (popped).
+    size_t _push_n(char* p, size_t n, int v);
+    size_t _pop_n(char* p, size_t n);
+
+    bool _can_push() const {
+        const uint64 pos = atomic_load(&_tail, mo_relaxed);
+        return atomic_load(&_seq[this->_index(pos)]) == (pos << 1);
+    }
+
+    bool _can_pop() const {
+        const uint64 pos = atomic_load(&_head, mo_relaxed);
+        return atomic_load(&_seq[this->_index(pos)]) == (pos << 1) + 1;
+    }
+
+    // index of the slot at position @pos, no division if _cap is power of 2
+    uint32 _index(uint64 pos) const {
+        return (uint32)(_pow2 ? (pos & (_cap - 1)) : (pos % _cap));
+    }
+
+    // Move elements between the ring and the waiters, until the ring is empty 
+    // (full) or no reader (writer) is waiting. It MUST be called with the mutex 
+    // locked. Waiters done are removed from the queue and woken up, except @self.
+    // As fast path readers and writers do not lock the mutex, readers and writers 
+    // may be waiting at the same time. Waiters of each kind are served in order, 
+    // a waiter that can not be served blocks those of the same kind after it.
+    void _transfer(waitx* self);
+
+    // Check state of a waiter, return 0 if it is waiting, 1 if it has been 
+    // claimed, or 2 if it has timed out, or another case of its select has 
+    // been chosen. A select being tried by another pipe is still waiting.
+    int _check(waitx* w) const {
+        if (!w->g) {
+            const uint8 x = atomic_load(&w->state, mo_relaxed);
+            return x == st_wait ? 0 : (x == st_ready ? 1 : 2);
+        }
+        if (atomic_load(&w->g->winner, mo_relaxed) == w) return 1;
+        const uint8 x = atomic_load(&w->g->state, mo_relaxed);
+        return (x == st_wait || x == st_busy) ? 0 : 2;
+    }
+
+    // Claim a waiter tentatively, return false if it has timed out or its 
+    // select is done. The claim MUST be confirmed or released before the mutex 
+    // is unlocked, the timer of a coroutine fires again later if it finds the 
+    // waiter busy, so the timeout will not be lost.
+    bool _claim(waitx* w) {
+        uint8* const s = w->g ? &w->g->state : &w->state;
+        for (;;) {
+            const uint8 x = atomic_cas(s, st_wait, st_busy, mo_relaxed, mo_relaxed);
+            if (x == st_wait) return true;
+            if (x != st_busy) return false;
+            cpu_relax(); // another pipe is trying the select, it is done soon
+        }
+    }
+
+    // the waiter claimed is done
+    void _confirm(waitx* w) {
+        if (!w->g) { atomic_store(&w->state, st_ready, mo_relaxed); return; }
+        atomic_store(&w->g->winner, (void*)w, mo_relaxed);
+        atomic_store(&w->g->state, st_ready, mo_relaxed);
+    }
+
+    // the waiter claimed can not be done, it waits again
+    void _release(waitx* w) {
+        atomic_store(w->g ? &w->g->state : &w->state, st_wait, mo_relaxed);
+    }
+
+    // remove a waiter from the queue
+    void _unlink(waitx* w) {
+        _wq.erase(w);
+        this->_dec_waiters();
+        w->x.linked = 0;
+    }
+
+    // free a waiter not claimed, waiters of a select belong to the select
+    void _drop(waitx* w) {
+        if (!w->g) co::free(w, w->len);
+    }
+
+    // the waiter after @w in the queue, or NULL
+    waitx* _next(waitx* w) const {
+        return (waitx*) w->next;
+    }
+
+    // pass the element to the first reader waiting, return false if no reader
+    bool _handoff(void* p, int v);
+
+    // Read (write) up to @n elements with the mutex locked, return the number 
+    // of elements done. Writers (readers) waiting are served in a single pass.
+    size_t _take(char* p, size_t n);
+    size_t _put(char* p, size_t n, int v);
+
+    void _wake(waitx* w) {
+        if (w->g) {
+            select_waitx* const g = w->g;
+            if (!g->co) {
+                g->ev->signal();
+            } else if (gSched && gSched->running() == g->co) {
+                g->self = true; // it is the select itself, it will not wait
+            } else {
+                g->co->sched->add_ready_task(g->co);
+            }
+            return;
+        }
+        w->co ? w->co->sched->add_ready_task(w->co) : xx::cv_notify_all(&_cv);
+    }
+
+    void _dec_waiters() {
+        atomic_store(&_nw, _nw - 1, mo_relaxed);
+    }
 
   private:
     char* _buf;       // buffer
+    uint64* _seq;     // sequence numbers of the slots
     uint32 _buf_size; // buffer size
     uint32 _blk_size; // block size
+    uint32 _cap;      // number of slots
     uint32 _ms;       // timeout in milliseconds
+    bool _pod;        // elements are trivially copyable
+    bool _pow2;       // _cap is power of 2
     bool _has_cv;
     xx::pipe::C _c;
     xx::pipe::D _d;
@@ -533,124 +1063,297 @@ class pipe_impl {
     xx::mutex _m;
     xx::cv_t _cv;
     co::clist _wq;
-    uint32 _rx; // read pos
-    uint32 _wx; // write pos
+    uint32 _nw; // number of waiters in _wq, written only with the mutex locked
     uint32 _refn;
-    uint8 _full;
     uint8 _closed;
+
+    union {
+        uint64 _head; // read pos
+        char _c0[co::cache_line_size];
+    };
+    union {
+        uint64 _tail; // write pos
+        char _c1[co::cache_line_size];
+    };
 };
 
-inline void pipe_impl::_read_block(void* p) {
-    _d(p);
-    _c(p, _buf + _rx, 1);
-    _d(_buf + _rx);
-    _rx += _blk_size;
-    if (_rx == _buf_size) _rx = 0;
+bool pipe_impl::_push(void* p, int v) {
+    uint64 pos = atomic_load(&_tail, mo_relaxed);
+    uint32 i;
+    for (;;) {
+        i = this->_index(pos);
+        const int64 d = (int64)(atomic_load(&_seq[i], mo_acquire) - (pos << 1));
+        if (d == 0) {
+            const uint64 x = atomic_cas(&_tail, pos, pos + 1, mo_relaxed, mo_relaxed);
+            if (x == pos) break;
+            pos = x;
+        } else if (d < 0) {
+            return false;
+        } else {
+            pos = atomic_load(&_tail, mo_relaxed);
+        }
+    }
+    this->_copy(_buf + i * _blk_size, p, v);
+    atomic_store(&_seq[i], (pos << 1) + 1);
+    return true;
 }
 
-inline void pipe_impl::_write_block(void* p, int v) {
-    _c(_buf + _wx, p, v);
-    _wx += _blk_size;
-    if (_wx == _buf_size) _wx = 0;
+bool pipe_impl::_pop(void* p, bool dtor) {
+    uint64 pos = atomic_load(&_head, mo_relaxed);
+    uint32 i;
+    for (;;) {
+        i = this->_index(pos);
+        const int64 d = (int64)(atomic_load(&_seq[i], mo_acquire) - ((pos << 1) + 1));
+        if (d == 0) {
+            const uint64 x = atomic_cas(&_head, pos, pos + 1, mo_relaxed, mo_relaxed);
+            if (x == pos) break;
+            pos = x;
+        } else if (d < 0) {
+            return false;
+        } else {
+            pos = atomic_load(&_head, mo_relaxed);
+        }
+    }
+    char* const b = _buf + i * _blk_size;
+    if (dtor) this->_destroy(p);
+    this->_copy(p, b, 1);
+    this->_destroy(b);
+    atomic_store(&_seq[i], (pos + _cap) << 1);
+    return true;
 }
 
-void pipe_impl::read(void* p) {
-    auto sched = gSched;
-    _m.lock();
+void pipe_impl::_transfer(waitx* self) {
+    for (;;) {
+        bool moved = false;
+        int blocked = 0; // 1: readers, 2: writers
+        waitx* w = (waitx*) _wq.front();
+        while (w && blocked != 3) {
+            waitx* const next = this->_next(w);
+            const int kind = w->x.rd ? 1 : 2;
+            if (blocked & kind) { w = next; continue; }
+
+            const int c = this->_check(w);
+            if (c != 1) {
+                // claim the waiter only if the ring seems ready for it, a fast 
+                // path reader or writer may still take the slot first, and the 
+                // waiter claimed is released then.
+                if (c == 0 && (w->x.rd ? !this->_can_pop() : !this->_can_push())) {
+                    blocked |= kind;
+                    w = next;
+                    continue;
+                }
+                if (c == 2 || !this->_claim(w)) {
+                    this->_unlink(w); /* timeout */
+                    this->_drop(w);
+                    w = next;
+                    continue;
+                }
+            }
 
-    // buffer is neither empty nor full
-    if (_rx != _wx) {
-        this->_read_block(p);
-        _m.unlock();
-        goto done;
+            const bool ok = w->x.rd ? this->_pop(w->buf, w->x.v & 2) : this->_push(w->buf, w->x.v & 1);
+            if (!ok) {
+                if (c != 1) this->_release(w);
+                blocked |= kind;
+                w = next;
+                continue;
+            }
+            if (!w->x.rd && (w->x.v & 2)) this->_destroy(w->buf);
+            if (c != 1) this->_confirm(w);
+            this->_unlink(w);
+            w->x.done = 1;
+            if (w != self) this->_wake(w);
+            moved = true;
+            w = next;
+        }
+
+        // a reader (writer) done may unblock writers (readers) waiting
+        if (!moved || !blocked) return;
     }
+}
 
-    // buffer is full
-    if (_full) {
-        this->_read_block(p);
+bool pipe_impl::_handoff(void* p, int v) {
+    waitx* next;
+    for (waitx* w = (waitx*) _wq.front(); w; w = next) {
+        next = this->_next(w);
+        if (!w->x.rd) continue;
+        this->_unlink(w);
+        const int c = this->_check(w);
+        if (c == 1 || (c == 0 && this->_claim(w))) {
+            if (c == 0) this->_confirm(w);
+            if (w->x.v & 2) this->_destroy(w->buf);
+            this->_copy(w->buf, p, v);
+            w->x.done = 1;
+            this->_wake(w);
+            return true;
+        } else { /* timeout */
+            this->_drop(w);
+        }
+    }
+    return false;
+}
 
-        while (!_wq.empty()) {
-            waitx* w = (waitx*) _wq.pop_front(); // wait for write
-            if (_ms == (uint32)-1 || atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                this->_write_block(w->buf, w->x.v & 1);
-                if (w->x.v & 2) _d(w->buf);
-                w->x.done = 1;
-                if (w->co) {
-                    _m.unlock();
-                    w->co->sched->add_ready_task(w->co);
-                } else {
-                    xx::cv_notify_all(&_cv);
-                    _m.unlock();
-                }
-                goto done;
+size_t pipe_impl::_push_n(char* p, size_t n, int v) {
+    if (n == 0) return 0;
+    uint64 pos = atomic_load(&_tail, mo_relaxed);
+    size_t k;
+    for (;;) {
+        for (k = 0; k < n && k < _cap; ++k) {
+            const uint64 x = pos + k;
+            if (atomic_load(&_seq[this->_index(x)], mo_acquire) != (x << 1)) break;
+        }
+        if (k == 0) {
+            const int64 d = (int64)(atomic_load(&_seq[this->_index(pos)], mo_acquire) - (pos << 1));
+            if (d < 0) return 0;
+            pos = atomic_load(&_tail, mo_relaxed);
+            continue;
+        }
+        const uint64 x = atomic_cas(&_tail, pos, pos + k, mo_relaxed, mo_relaxed);
+        if (x == pos) break;
+        pos = x;
+    }
+    for (size_t j = 0; j < k; ++j) {
+        const uint32 i = this->_index(pos + j);
+        this->_copy(_buf + i * _blk_size, p + j * _blk_size, v);
+        atomic_store(&_seq[i], ((pos + j) << 1) + 1);
+    }
+    return k;
+}
 
-            } else { /* timeout */
-                if (w->x.v & 2) _d(w->buf);
-                co::free(w, w->len);
-            }
+size_t pipe_impl::_pop_n(char* p, size_t n) {
+    if (n == 0) return 0;
+    uint64 pos = atomic_load(&_head, mo_relaxed);
+    size_t k;
+    for (;;) {
+        for (k = 0; k < n && k < _cap; ++k) {
+            const uint64 x = pos + k;
+            if (atomic_load(&_seq[this->_index(x)], mo_acquire) != (x << 1) + 1) break;
         }
+        if (k == 0) {
+            const int64 d = (int64)(atomic_load(&_seq[this->_index(pos)], mo_acquire) - ((pos << 1) + 1));
+            if (d < 0) return 0;
+            pos = atomic_load(&_head, mo_relaxed);
+            continue;
+        }
+        const uint64 x = atomic_cas(&_head, pos, pos + k, mo_relaxed, mo_relaxed);
+        if (x == pos) break;
+        pos = x;
+    }
+    for (size_t j = 0; j < k; ++j) {
+        const uint32 i = this->_index(pos + j);
+        char* const b = _buf + i * _blk_size;
+        char* const x = p + j * _blk_size;
+        this->_destroy(x);
+        this->_copy(x, b, 1);
+        this->_destroy(b);
+        atomic_store(&_seq[i], (pos + j + _cap) << 1);
+    }
+    return k;
+}
 
-        _full = 0;
-        _m.unlock();
+size_t pipe_impl::_take(char* p, size_t n) {
+    this->_transfer(0);
+    size_t k = this->_pop_n(p, n);
+    while (k < n && !_wq.empty()) {
+        this->_transfer(0); // writers waiting fill the ring again
+        const size_t x = this->_pop_n(p + k * _blk_size, n - k);
+        if (x == 0) break;
+        k += x;
+    }
+    this->_transfer(0);
+    return k;
+}
+
+size_t pipe_impl::_put(char* p, size_t n, int v) {
+    size_t k = 0;
+    this->_transfer(0);
+    while (k < n && this->_handoff(p + k * _blk_size, v)) ++k;
+    return k + this->_push_n(p + k * _blk_size, n - k, v);
+}
+
+void pipe_impl::read(void* p) {
+    // fast path, nobody is waiting
+    if (atomic_load(&_nw, mo_relaxed) == 0 && this->_pop(p, true)) {
+        // writers may be waiting for the free slot
+        if (atomic_load(&_nw) > 0) {
+            xx::mutex_guard g(_m);
+            this->_transfer(0);
+        }
         goto done;
     }
 
-    // buffer is empty
-    if (this->is_closed()) { _m.unlock(); goto enod; }
-    if (sched) {
-        auto co = sched->running();
+    {
+        auto sched = gSched;
+        _m.lock();
+        this->_transfer(0);
+        if (this->_pop(p, true)) {
+            this->_transfer(0);
+            _m.unlock();
+            goto done;
+        }
+
+        // buffer is empty
+        if (this->is_closed()) { _m.unlock(); goto enod; }
+        auto co = sched ? sched->running() : 0;
         waitx* w = this->create_waitx(co, p);
+        w->x.rd = 1;
         w->x.v = (w->buf != p ? 0 : 2);
         _wq.push_back(w);
-        _m.unlock();
+        atomic_store(&_nw, _nw + 1);
 
-        co->waitx = (waitx_t*)w;
-        if (_ms != (uint32)-1) sched->add_timer(_ms);
-        sched->yield();
+        // a writer may have pushed an element before it sees this waiter
+        this->_transfer(w);
+        if (w->x.done) {
+            _m.unlock();
+            goto move;
+        }
 
-        co->waitx = 0;
-        if (!sched->timeout()) {
-            if (w->x.done == 1) {
-                if (w->buf != p) {
-                    _d(p);
-                    _c(p, w->buf, 1); // mv
-                    _d(w->buf);
-                }
-                co::free(w, w->len);
-                goto done;
-            }
+        if (co) {
+            _m.unlock();
+            co->waitx = (waitx_t*)w;
+            if (_ms != (uint32)-1) sched->add_timer(_ms);
+            sched->yield();
 
-            assert(w->x.done == 2); // channel closed
-            co::free(w, w->len);
+            co->waitx = 0;
+            if (!sched->timeout()) {
+                if (w->x.done == 1) goto move;
+                assert(w->x.done == 2); // channel closed
+                co::free(w, w->len);
+            }
             goto enod;
-        }
-        goto enod;
 
-    } else {
-        bool r = true;
-        waitx* w = this->create_waitx(NULL, p);
-        _wq.push_back(w);
-        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        } else {
+            bool r = true;
+            if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
 
-        for (;;) {
-            if (_ms == (uint32)-1) {
-                xx::cv_wait(&_cv, _m.native_handle());
-            } else {
-                r = xx::cv_wait(&_cv, _m.native_handle(), _ms);
-            }
-            if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
-                const auto x = w->x.done;
-                if (x) {
+            for (;;) {
+                if (_ms == (uint32)-1) {
+                    xx::cv_wait(&_cv, _m.native_handle());
+                } else {
+                    r = xx::cv_wait(&_cv, _m.native_handle(), _ms);
+                }
+                if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
+                    const auto x = w->x.done;
+                    if (x) {
+                        _m.unlock();
+                        co::free(w, w->len);
+                        if (x == 1) goto done;
+                        goto enod; // x == 2, channel closed
+                    }
+                } else {
                     _m.unlock();
-                    co::free(w, w->len);
-                    if (x == 1) goto done;
-                    goto enod; // x == 2, channel closed
+                    goto enod;
                 }
-            } else {
-                _m.unlock();
-                goto enod;
             }
         }
+
+      move:
+        if (w->buf != p) {
+            this->_destroy(p);
+            this->_copy(p, w->buf, 1); // mv
+            this->_destroy(w->buf);
+        }
+        co::free(w, w->len);
+        goto done;
     }
 
   enod:
@@ -661,95 +1364,86 @@ void pipe_impl::read(void* p) {
 }
 
 void pipe_impl::write(void* p, int v) {
-    auto sched = gSched;
-    _m.lock();
-    if (this->is_closed()) { _m.unlock(); goto enod; }
+    if (this->is_closed()) goto enod;
 
-    // buffer is neither empty nor full
-    if (_rx != _wx) {
-        this->_write_block(p, v);
-        if (_rx == _wx) _full = 1;
-        _m.unlock();
+    // fast path, nobody is waiting
+    if (atomic_load(&_nw, mo_relaxed) == 0 && this->_push(p, v)) {
+        // readers may be waiting for the element
+        if (atomic_load(&_nw) > 0) {
+            xx::mutex_guard g(_m);
+            this->_transfer(0);
+        }
         goto done;
-    } 
+    }
 
-    // buffer is empty
-    if (!_full) {
-        while (!_wq.empty()) {
-            waitx* w = (waitx*) _wq.pop_front(); // wait for read
-            if (_ms == (uint32)-1 || atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                w->x.done = 1;
-                if (w->co) {
-                    if (w->x.v & 2) _d(w->buf);
-                    _c(w->buf, p, v);
-                    _m.unlock();
-                    w->co->sched->add_ready_task(w->co);
-                } else {
-                    _d(w->buf);
-                    _c(w->buf, p, v);
-                    xx::cv_notify_all(&_cv);
-                    _m.unlock();
-                }
-                goto done;
+    {
+        auto sched = gSched;
+        _m.lock();
+        if (this->is_closed()) { _m.unlock(); goto enod; }
+        this->_transfer(0);
 
-            } else { /* timeout */
-                co::free(w, w->len);
-            }
+        // readers are still waiting, the buffer is empty, pass the element 
+        // to the first one directly
+        if (this->_handoff(p, v) || this->_push(p, v)) {
+            _m.unlock();
+            goto done;
         }
 
-        this->_write_block(p, v);
-        if (_rx == _wx) _full = 1;
-        _m.unlock();
-        goto done;
-    }
-    
-    // buffer is full
-    if (sched) {
-        auto co = sched->running();
+        // buffer is full
+        auto co = sched ? sched->running() : 0;
         waitx* w = this->create_waitx(co, p);
+        w->x.rd = 0;
         if (w->buf != p) { /* p is on the coroutine stack */
-            _c(w->buf, p, v);
+            this->_copy(w->buf, p, v);
             w->x.v = 1 | 2;
         } else {
             w->x.v = (uint8)v;
         }
         _wq.push_back(w);
-        _m.unlock();
-
-        co->waitx = (waitx_t*)w;
-        if (_ms != (uint32)-1) sched->add_timer(_ms);
-        sched->yield();
+        atomic_store(&_nw, _nw + 1);
 
-        co->waitx = 0;
-        if (!sched->timeout()) {
+        // a reader may have freed a slot before it sees this waiter
+        this->_transfer(w);
+        if (w->x.done) {
+            _m.unlock();
             co::free(w, w->len);
             goto done;
         }
-        goto enod; // timeout
 
-    } else {
-        bool r = true;
-        waitx* w = this->create_waitx(NULL, p);
-        w->x.v = (uint8)v;
-        _wq.push_back(w);
-        if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+        if (co) {
+            _m.unlock();
+            co->waitx = (waitx_t*)w;
+            if (_ms != (uint32)-1) sched->add_timer(_ms);
+            sched->yield();
 
-        for (;;) {
-            if (_ms == (uint32)-1) {
-                xx::cv_wait(&_cv, _m.native_handle());
-            } else {
-                r = xx::cv_wait(&_cv, _m.native_handle(), _ms);
+            co->waitx = 0;
+            if (!sched->timeout()) {
+                co::free(w, w->len);
+                goto done;
             }
-            if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
-                if (w->x.done) {
-                    assert(w->x.done == 1);
+            goto enod; // timeout
+
+        } else {
+            bool r = true;
+            if (!_has_cv) { xx::cv_init(&_cv); _has_cv = true; }
+
+            for (;;) {
+                if (_ms == (uint32)-1) {
+                    xx::cv_wait(&_cv, _m.native_handle());
+                } else {
+                    r = xx::cv_wait(&_cv, _m.native_handle(), _ms);
+                }
+                if (r || !atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
+                    if (w->x.done) {
+                        assert(w->x.done == 1);
+                        _m.unlock();
+                        co::free(w, w->len);
+                        goto done;
+                    }
+                } else {
                     _m.unlock();
-                    co::free(w, w->len);
-                    goto done;
+                    goto enod;
                 }
-            } else {
-                _m.unlock();
-                goto enod;
             }
         }
     }
@@ -761,30 +1455,216 @@ void pipe_impl::write(void* p, int v) {
     g_done = true;
 }
 
+size_t pipe_impl::read_n(void* p, size_t n) {
+    char* const s = (char*)p;
+    size_t k = 0;
+    if (n == 0) goto done;
+
+    // fast path, nobody is waiting
+    if (atomic_load(&_nw, mo_relaxed) == 0) {
+        k = this->_pop_n(s, n);
+        if (k > 0 && atomic_load(&_nw) == 0) goto done;
+    }
+    {
+        xx::mutex_guard g(_m);
+        k += this->_take(s + k * _blk_size, n - k);
+    }
+    if (k > 0) goto done;
+
+    // buffer is empty, wait for the first element, and take the rest if any
+    this->read(s);
+    if (!g_done) return 0;
+    k = 1;
+    if (k < n && (atomic_load(&_nw) > 0 || this->_can_pop())) {
+        xx::mutex_guard g(_m);
+        k += this->_take(s + k * _blk_size, n - k);
+    }
+
+  done:
+    g_done = true;
+    return k;
+}
+
+size_t pipe_impl::write_n(void* p, size_t n, int v) {
+    char* const s = (char*)p;
+    size_t k = 0;
+    while (k < n && !this->is_closed()) {
+        // fast path, nobody is waiting
+        if (atomic_load(&_nw, mo_relaxed) == 0) {
+            k += this->_push_n(s + k * _blk_size, n - k, v);
+        }
+        if (k < n || atomic_load(&_nw) > 0) {
+            xx::mutex_guard g(_m);
+            if (this->is_closed()) break;
+            k += this->_put(s + k * _blk_size, n - k, v);
+        }
+        if (k == n) break;
+
+        // buffer is full, wait to write the next element
+        this->write(s + k * _blk_size, v);
+        if (!g_done) break;
+        ++k;
+    }
+    g_done = k == n;
+    return k;
+}
+
+// The channel is closed with the mutex locked, another thread closing it at 
+// the same time blocks on the mutex, and returns after the first one is done.
+// Readers waiting are woken up if the buffer is empty, writers waiting are 
+// still served by readers, waiters timed out are freed here.
 void pipe_impl::close() {
-    const auto x = atomic_cas(&_closed, 0, 1, mo_relaxed, mo_relaxed);
-    if (x == 0) {
+    if (atomic_load(&_closed, mo_relaxed) == 2) return;
+    xx::mutex_guard g(_m);
+    if (_closed) return;
+    atomic_store(&_closed, 1, mo_relaxed);
+    this->_transfer(0);
+
+    const bool empty = !this->_can_pop();
+    waitx* next;
+    for (waitx* w = (waitx*) _wq.front(); w; w = next) {
+        next = this->_next(w);
+        const int c = this->_check(w);
+        if (c == 2) { /* timeout */
+            this->_unlink(w);
+            this->_drop(w);
+            continue;
+        }
+        if (!w->x.rd || !empty) continue;
+        this->_unlink(w);
+        if (c == 1 || this->_claim(w)) {
+            if (c == 0) this->_confirm(w);
+            w->x.done = 2; // channel closed
+            this->_wake(w);
+        } else {
+            this->_drop(w);
+        }
+    }
+    atomic_store(&_closed, 2, mo_relaxed);
+}
+
+int pipe_impl::try_read(void* p) {
+    if (atomic_load(&_nw, mo_relaxed) == 0 && this->_pop(p, true)) {
+        if (atomic_load(&_nw) > 0) {
+            xx::mutex_guard g(_m);
+            this->_transfer(0);
+        }
+        return 1;
+    }
+
+    xx::mutex_guard g(_m);
+    this->_transfer(0);
+    if (this->_pop(p, true)) {
+        this->_transfer(0);
+        return 1;
+    }
+    return this->is_closed() ? 2 : 0;
+}
+
+int pipe_impl::try_write(void* p, int v) {
+    if (this->is_closed()) return 2;
+    if (atomic_load(&_nw, mo_relaxed) == 0 && this->_push(p, v)) {
+        if (atomic_load(&_nw) > 0) {
+            xx::mutex_guard g(_m);
+            this->_transfer(0);
+        }
+        return 1;
+    }
+
+    xx::mutex_guard g(_m);
+    if (this->is_closed()) return 2;
+    this->_transfer(0);
+    return (this->_handoff(p, v) || this->_push(p, v)) ? 1 : 0;
+}
+
+void pipe_impl::init_waiter(waitx* w, select_waitx* g, void* x, int op, void* buf) {
+    w->next = w->prev = 0;
+    w->co = g->co;
+    w->state = st_wait;
+    w->x.done = 0;
+    w->x.rd = op < 0;
+    w->x.linked = 0;
+    w->len = 0;
+    w->g = g;
+    if (buf) {
+        w->buf = buf;
+        if (op < 0) {
+            w->x.v = 0;
+        } else {
+            this->_copy(buf, x, op);
+            w->x.v = 1 | 2;
+        }
+    } else {
+        w->buf = x;
+        w->x.v = (uint8)(op < 0 ? 2 : op);
+    }
+}
+
+void pipe_impl::add_waiter(waitx* w) {
+    xx::mutex_guard g(_m);
+    const uint8 s = atomic_load(&w->g->state, mo_relaxed);
+    if (s != st_wait && s != st_busy) return;
+    _wq.push_back(w);
+    w->x.linked = 1;
+    atomic_store(&_nw, _nw + 1);
+
+    // an element or a free slot may come before the waiter is counted
+    this->_transfer(0);
+
+    // the channel was closed before the waiter is added
+    if (w->x.linked && w->x.rd && atomic_load(&_closed, mo_relaxed) == 2 && !this->_can_pop()) {
+        this->_unlink(w);
+        const int c = this->_check(w);
+        if (c == 1 || (c == 0 && this->_claim(w))) {
+            if (c == 0) this->_confirm(w);
+            w->x.done = 2;
+            this->_wake(w);
+        }
+    }
+}
+
+void pipe_impl::del_waiter(waitx* w, void* x) {
+    {
         xx::mutex_guard g(_m);
-        if (_rx == _wx && !_full) { /* empty */
-            while (!_wq.empty()) {
-                waitx* w = (waitx*) _wq.pop_front(); // wait for read
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                    w->x.done = 2; // channel closed
-                    if (w->co) {
-                        w->co->sched->add_ready_task(w->co);
-                    } else {
-                        xx::cv_notify_all(&_cv);
-                    }
-                } else {
-                    co::free(w, w->len);
-                }
-            }
+        if (w->x.linked) this->_unlink(w);
+    }
+
+    const bool chosen = atomic_load(&w->g->winner, mo_relaxed) == w;
+    if (w->x.rd) {
+        if (chosen && w->x.done == 1 && w->buf != x) {
+            this->_destroy(x);
+            this->_copy(x, w->buf, 1); // mv
+            this->_destroy(w->buf);
         }
-        atomic_store(&_closed, 2, mo_relaxed);
+    } else if (!chosen && (w->x.v & 2)) {
+        this->_destroy(w->buf); // the element saved was not written
+    }
+}
+
+struct select_buf {
+    void* p;
+    size_t n;
+};
 
-    } else if (x == 1) {
-        while (atomic_load(&_closed, mo_relaxed) != 2) co::sleep(1);
+// memory for co::select() is cached in each thread, no allocation on each call
+static __thread co::vector<select_buf>* g_select_bufs;
+static __thread co::sync_event* g_select_ev;
+
+inline select_buf pop_select_buf(size_t n) {
+    if (!g_select_bufs) g_select_bufs = co::make<co::vector<select_buf>>(8);
+    auto& v = *g_select_bufs;
+    if (!v.empty()) {
+        const select_buf b = v.pop_back();
+        if (b.n >= n) return b;
+        co::free(b.p, b.n);
     }
+    n = god::align_up<256>(n);
+    return select_buf{ co::alloc(n), n };
+}
+
+inline void push_select_buf(const select_buf& b) {
+    auto& v = *g_select_bufs;
+    v.size() < 8 ? v.push_back(b) : co::free(b.p, b.n);
 }
 
 pipe::pipe(uint32 buf_size, uint32 blk_size, uint32 ms, pipe::C&& c, pipe::D&& d) {
@@ -813,6 +1693,14 @@ void pipe::write(void* p, int v) const {
     god::cast<pipe_impl*>(_p)->write(p, v);
 }
 
+size_t pipe::read_n(void* p, size_t n) const {
+    return god::cast<pipe_impl*>(_p)->read_n(p, n);
+}
+
+size_t pipe::write_n(void* p, size_t n, int v) const {
+    return god::cast<pipe_impl*>(_p)->write_n(p, n, v);
+}
+
 bool pipe::done() const {
     return god::cast<pipe_impl*>(_p)->done();
 }
@@ -825,17 +1713,125 @@ bool pipe::is_closed() const {
     return god::cast<pipe_impl*>(_p)->is_closed();
 }
 
+int pipe::select(const select_case* cases, int n, uint32 ms) {
+    typedef pipe_impl::waitx waitx;
+    auto impl = [](const select_case& c) { return god::cast<pipe_impl*>(c.p->_p); };
+
+    // check all cases without waiting, start from a random one for fairness
+    const int k = n > 1 ? (int)(co::rand() % (uint32)n) : 0;
+    for (int j = 0; j < n; ++j) {
+        const int i = k + j < n ? k + j : k + j - n;
+        const auto& c = cases[i];
+        const int r = c.op < 0 ? impl(c)->try_read(c.x) : impl(c)->try_write(c.x, c.op);
+        if (r) {
+            g_done = r == 1;
+            return i;
+        }
+    }
+    if (n <= 0 || ms == 0) {
+        g_done = false;
+        return -1;
+    }
+
+    // wait for all cases, the select and its waiters are not on the stack, as 
+    // other threads may access them while the coroutine is suspended
+    const auto sched = gSched;
+    Coroutine* const co = sched ? sched->running() : 0;
+    size_t size = sizeof(select_waitx) + n * sizeof(waitx);
+    for (int i = 0; i < n; ++i) {
+        if (co && sched->on_shared_stack(cases[i].x)) {
+            size += god::align_up<8>((size_t)impl(cases[i])->blk_size());
+        }
+    }
+
+    const select_buf b = pop_select_buf(size);
+    select_waitx* const g = (select_waitx*) b.p;
+    waitx* const w = (waitx*)(g + 1);
+    char* x = (char*)(w + n);
+    g->next = g->prev = 0;
+    g->co = co;
+    g->state = st_wait;
+    g->winner = 0;
+    g->self = false;
+    g->ev = 0;
+    if (!co) {
+        if (!g_select_ev) g_select_ev = co::make<co::sync_event>();
+        g->ev = g_select_ev;
+        g->ev->reset();
+    }
+
+    for (int i = 0; i < n; ++i) {
+        const auto& c = cases[i];
+        char* buf = 0;
+        if (co && sched->on_shared_stack(c.x)) {
+            buf = x;
+            x += god::align_up<8>((size_t)impl(c)->blk_size());
+        }
+        impl(c)->init_waiter(&w[i], g, c.x, c.op, buf);
+    }
+    for (int i = 0; i < n; ++i) {
+        impl(cases[i])->add_waiter(&w[i]);
+        const uint8 s = atomic_load(&g->state, mo_relaxed);
+        if (s != st_wait && s != st_busy) break;
+    }
+
+    if (co) {
+        if (!g->self) {
+            co->waitx = (waitx_t*)g;
+            if (ms != (uint32)-1) sched->add_timer(ms);
+            sched->yield();
+            co->waitx = 0;
+        }
+    } else {
+        for (;;) {
+            const auto x = (waitx*) atomic_load(&g->winner, mo_acquire);
+            if (x && atomic_load(&x->x.done, mo_acquire)) break;
+            if (ms == (uint32)-1 || atomic_load(&g->state, mo_relaxed) == st_ready) {
+                g->ev->wait();
+            } else if (!g->ev->wait(ms)) {
+                // a pipe may be trying a case, wait until it is done or released
+                uint8 s;
+                while ((s = atomic_cas(&g->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) == st_busy) {
+                    cpu_relax();
+                }
+                if (s == st_wait) break;
+            }
+        }
+    }
+
+    int r = -1;
+    for (int i = 0; i < n; ++i) {
+        impl(cases[i])->del_waiter(&w[i], cases[i].x);
+        if (g->winner == &w[i]) r = i;
+    }
+    g_done = r >= 0 && w[r].x.done == 1;
+    push_select_buf(b);
+    return r;
+}
+
 class pool_impl {
   public:
-    typedef co::vector<void*> V;
+    struct entry {
+        void* p;
+        int64 t; // time(ms) the element was pushed, 0 if idle timeout is not set
+    };
+    typedef co::vector<entry> V;
+
+    // pool of a scheduler, counters are written only by the scheduler
+    struct local {
+        V v;
+        pool_stats st;
+        char _c[co::cache_line_size * 2 - sizeof(V) - sizeof(pool_stats)];
+    };
 
     pool_impl()
-        : _maxcap((size_t)-1), _refn(1) {
+        : _maxcap((size_t)-1), _lowat((size_t)-1), _refn(1), _shared_cap(0), _shared_n(0), _idle_ms(0) {
         this->_make_pools();
     }
 
     pool_impl(std::function<void*()>&& ccb, std::function<void(void*)>&& dcb, size_t cap)
-        : _maxcap(cap), _refn(1), _ccb(std::move(ccb)), _dcb(std::move(dcb)) {
+        : _maxcap(cap), _lowat(cap), _refn(1), _shared_cap(0), _shared_n(0), _idle_ms(0),
+          _ccb(std::move(ccb)), _dcb(std::move(dcb)) {
         this->_make_pools();
     }
 
@@ -847,43 +1843,179 @@ class pool_impl {
     void* pop();
     void push(void* p);
     void clear();
+    void evict();
     size_t size() const;
+    pool_stats stats() const;
+
+    // A thread keeps up to its share of the shared capacity in its own pool, 
+    // elements beyond that go to the shared pool, so that threads with an 
+    // empty pool can borrow them.
+    void set_shared_cap(size_t cap) {
+        _shared_cap = cap;
+        const size_t share = cap > _size ? cap / _size : 1;
+        _lowat = cap == 0 ? _maxcap : (share < _maxcap ? share : _maxcap);
+    }
+    void set_idle_timeout(uint32 ms) { _idle_ms = ms; }
+    void set_health_check(std::function<bool(void*)>&& hcb) { _hcb = std::move(hcb); }
 
     void _make_pools() {
         _size = co::sched_num();
-        _pools = (V*) co::zalloc(sizeof(V) * _size);
+        _pools = (local*) co::alloc(sizeof(local) * _size, co::cache_line_size);
+        memset((void*)_pools, 0, sizeof(local) * _size);
     }
 
     void _free_pools() {
-        for (int i = 0; i < _size; ++i) _pools[i].~V();
-        co::free(_pools, sizeof(V) * _size);
+        for (size_t i = 0; i < _size; ++i) _pools[i].v.~V();
+        co::free(_pools, sizeof(local) * _size);
     }
 
     void ref() { atomic_inc(&_refn, mo_relaxed); }
     uint32 unref() { return atomic_dec(&_refn, mo_acq_rel); }
 
   private:
-    V* _pools;
+    // return true if the element is ok, or destroy it and return false
+    bool _check(void* p, pool_stats& st) {
+        if (!_hcb || _hcb(p)) return true;
+        if (_dcb) _dcb(p);
+        inc(st.drops);
+        return false;
+    }
+
+    // Number of elements idle for too long. Elements are pushed to the back 
+    // with the current time, so the oldest ones are at the front.
+    size_t _expired(const V& v, int64 now_ms) const {
+        if (v.empty() || now_ms - v[0].t <= _idle_ms) return 0;
+        size_t k = 1;
+        while (k < v.size() && now_ms - v[k].t > _idle_ms) ++k;
+        return k;
+    }
+
+    // remove the first @k elements, they are moved to @out if it is not NULL
+    static void _erase_front(V& v, size_t k, V* out) {
+        if (out) out->append(v.data(), k);
+        memmove(v.data(), v.data() + k, (v.size() - k) * sizeof(entry));
+        v.resize(v.size() - k);
+    }
+
+    // destroy elements idle for too long in the pool of a scheduler
+    void _evict(V& v, int64 now_ms, pool_stats& st) {
+        const size_t k = this->_expired(v, now_ms);
+        if (k == 0) return;
+        for (size_t i = 0; i < k; ++i) _dcb(v[i].p);
+        _erase_front(v, k, nullptr);
+        inc(st.evicts, k);
+    }
+
+    // Take elements idle for too long from the shared pool, it MUST be called 
+    // with _sm locked. They are destroyed by _destroy_shared() after the lock 
+    // is released, as dcb may be slow or use the pool.
+    void _expire_shared(int64 now_ms, V& out) {
+        const size_t k = this->_expired(_shared, now_ms);
+        if (k > 0) _erase_front(_shared, k, &out);
+    }
+
+    void _destroy_shared(V& v) {
+        if (v.empty()) return;
+        for (size_t i = 0; i < v.size(); ++i) _dcb(v[i].p);
+        atomic_add(&_shared_st.evicts, (uint64)v.size(), mo_relaxed);
+        v.clear();
+    }
+
+    void _evict_shared(int64 now_ms) {
+        V x;
+        {
+            xx::mutex_guard g(_sm);
+            this->_expire_shared(now_ms, x);
+            atomic_store(&_shared_n, _shared.size(), mo_relaxed);
+        }
+        this->_destroy_shared(x);
+    }
+
+    // counters are read by stats() in other threads
+    static void inc(uint64& x, uint64 n=1) {
+        atomic_store(&x, x + n, mo_relaxed);
+    }
+
+  private:
+    local* _pools;
     size_t _size;
     size_t _maxcap;
+    size_t _lowat; // elements beyond it go to the shared pool if it is enabled
     uint32 _refn;
+    size_t _shared_cap;
+    size_t _shared_n; // number of elements in the shared pool
+    uint32 _idle_ms;
     std::function<void*()> _ccb;
     std::function<void(void*)> _dcb;
+    std::function<bool(void*)> _hcb;
+
+    xx::mutex _sm; // for the shared pool
+    V _shared;
+    pool_stats _shared_st; // evicts of the shared pool, updated atomically
 };
 
-inline void* pool_impl::pop() {
+void* pool_impl::pop() {
     auto s = gSched;
     CHECK(s) << "must be called in coroutine..";
-    auto& v = _pools[s->id()];
-    return !v.empty() ? v.pop_back() : (_ccb ? _ccb() : nullptr);
+    auto& l = _pools[s->id()];
+    const bool idle = _idle_ms > 0 && _dcb;
+    if (idle) this->_evict(l.v, now::ms(), l.st);
+
+    while (!l.v.empty()) {
+        void* const p = l.v.pop_back().p;
+        if (this->_check(p, l.st)) { inc(l.st.hits); return p; }
+    }
+
+    // borrow an element from the shared pool
+    while (atomic_load(&_shared_n, mo_relaxed) > 0) {
+        void* p = 0;
+        V x;
+        {
+            xx::mutex_guard g(_sm);
+            if (idle) this->_expire_shared(now::ms(), x);
+            if (!_shared.empty()) p = _shared.pop_back().p;
+            atomic_store(&_shared_n, _shared.size(), mo_relaxed);
+        }
+        this->_destroy_shared(x);
+        if (!p) break;
+        if (this->_check(p, l.st)) {
+            inc(l.st.hits);
+            inc(l.st.borrows);
+            return p;
+        }
+    }
+
+    inc(l.st.misses);
+    if (!_ccb) return nullptr;
+    inc(l.st.creates);
+    return _ccb();
 }
 
-inline void pool_impl::push(void* p) {
+void pool_impl::push(void* p) {
     if (p) {
         auto s = gSched;
         CHECK(s) << "must be called in coroutine..";
-        auto& v = _pools[s->id()];
-        (v.size() < _maxcap || !_dcb) ? v.push_back(p) : _dcb(p);
+        auto& l = _pools[s->id()];
+        const bool idle = _idle_ms > 0 && _dcb;
+        const int64 now_ms = idle ? now::ms() : 0;
+        if (idle) this->_evict(l.v, now_ms, l.st);
+        if (l.v.size() < _lowat) {
+            l.v.push_back(entry{ p, now_ms });
+            return;
+        }
+        if (_shared_cap > 0) {
+            xx::mutex_guard g(_sm);
+            if (_shared.size() < _shared_cap) {
+                _shared.push_back(entry{ p, now_ms });
+                atomic_store(&_shared_n, _shared.size(), mo_relaxed);
+                return;
+            }
+        }
+        if (l.v.size() < _maxcap || !_dcb) {
+            l.v.push_back(entry{ p, now_ms });
+            return;
+        }
+        _dcb(p);
     }
 }
 
@@ -895,8 +2027,8 @@ void pool_impl::clear() {
         co::wait_group wg((uint32)scheds.size());
         for (auto& s : scheds) {
             s->go([this, wg]() {
-                auto& v = this->_pools[gSched->id()];
-                if (this->_dcb) for (auto& e : v) this->_dcb(e);
+                auto& v = this->_pools[gSched->id()].v;
+                if (this->_dcb) for (auto& e : v) this->_dcb(e.p);
                 v.clear();
                 wg.done();
             });
@@ -904,17 +2036,64 @@ void pool_impl::clear() {
         wg.wait();
     } else {
         for (size_t i = 0; i < _size; ++i) {
-            auto& v = _pools[i];
-            if (this->_dcb) for (auto& e : v) this->_dcb(e);
+            auto& v = _pools[i].v;
+            if (this->_dcb) for (auto& e : v) this->_dcb(e.p);
             v.clear();
         }
     }
+
+    V x;
+    {
+        xx::mutex_guard g(_sm);
+        x.swap(_shared);
+        atomic_store(&_shared_n, 0, mo_relaxed);
+    }
+    if (this->_dcb) for (auto& e : x) this->_dcb(e.p);
+}
+
+// like clear(), but only elements idle for too long are destroyed
+void pool_impl::evict() {
+    if (_idle_ms == 0 || !_dcb) return;
+    if (xx::is_active()) {
+        auto& scheds = co::scheds();
+        co::wait_group wg((uint32)scheds.size());
+        for (auto& s : scheds) {
+            s->go([this, wg]() {
+                auto& l = this->_pools[gSched->id()];
+                this->_evict(l.v, now::ms(), l.st);
+                wg.done();
+            });
+        }
+        wg.wait();
+    } else {
+        const int64 now_ms = now::ms();
+        for (size_t i = 0; i < _size; ++i) {
+            this->_evict(_pools[i].v, now_ms, _pools[i].st);
+        }
+    }
+    this->_evict_shared(now::ms());
 }
 
 inline size_t pool_impl::size() const {
     auto s = gSched;
     CHECK(s) << "must be called in coroutine..";
-    return _pools[s->id()].size();
+    return _pools[s->id()].v.size();
+}
+
+pool_stats pool_impl::stats() const {
+    pool_stats r;
+    memset(&r, 0, sizeof(r));
+    auto add = [&r](const pool_stats& x) {
+        r.hits += atomic_load(&x.hits, mo_relaxed);
+        r.borrows += atomic_load(&x.borrows, mo_relaxed);
+        r.misses += atomic_load(&x.misses, mo_relaxed);
+        r.creates += atomic_load(&x.creates, mo_relaxed);
+        r.evicts += atomic_load(&x.evicts, mo_relaxed);
+        r.drops += atomic_load(&x.drops, mo_relaxed);
+    };
+    for (size_t i = 0; i < _size; ++i) add(_pools[i].st);
+    add(_shared_st);
+    return r;
 }
 
 } // xx
@@ -949,6 +2128,48 @@ bool mutex::try_lock() const {
     return god::cast<xx::mutex_impl*>(_p)->try_lock();
 }
 
+rwmutex::rwmutex() {
+    _p = co::alloc(sizeof(xx::rwmutex_impl), co::cache_line_size);
+    new (_p) xx::rwmutex_impl();
+}
+
+rwmutex::rwmutex(const rwmutex& m) : _p(m._p) {
+    if (_p) god::cast<xx::rwmutex_impl*>(_p)->ref();
+}
+
+rwmutex::~rwmutex() {
+    const auto p = (xx::rwmutex_impl*)_p;
+    if (p && p->unref() == 0) {
+        p->~rwmutex_impl();
+        co::free(_p, sizeof(xx::rwmutex_impl));
+        _p = 0;
+    }
+}
+
+void rwmutex::lock() const {
+    god::cast<xx::rwmutex_impl*>(_p)->lock();
+}
+
+void rwmutex::unlock() const {
+    god::cast<xx::rwmutex_impl*>(_p)->unlock();
+}
+
+bool rwmutex::try_lock() const {
+    return god::cast<xx::rwmutex_impl*>(_p)->try_lock();
+}
+
+void rwmutex::lock_shared() const {
+    god::cast<xx::rwmutex_impl*>(_p)->lock_shared();
+}
+
+void rwmutex::unlock_shared() const {
+    god::cast<xx::rwmutex_impl*>(_p)->unlock_shared();
+}
+
+bool rwmutex::try_lock_shared() const {
+    return god::cast<xx::rwmutex_impl*>(_p)->try_lock_shared();
+}
+
 
 event::event(bool manual_reset, bool signaled) {
     _p = co::alloc(sizeof(xx::event_impl), co::cache_line_size);
@@ -1011,6 +2232,36 @@ bool sync_event::wait(uint32 ms) {
 }
 
 
+semaphore::semaphore(uint32 n) {
+    _p = co::alloc(sizeof(xx::semaphore_impl), co::cache_line_size);
+    new (_p) xx::semaphore_impl(n);
+}
+
+semaphore::semaphore(const semaphore& s) : _p(s._p) {
+    if (_p) god::cast<xx::semaphore_impl*>(_p)->ref();
+}
+
+semaphore::~semaphore() {
+    const auto p = (xx::semaphore_impl*)_p;
+    if (p && p->unref() == 0) {
+        p->~semaphore_impl();
+        co::free(_p, sizeof(xx::semaphore_impl));
+        _p = 0;
+    }
+}
+
+bool semaphore::acquire(uint32 n, uint32 ms) const {
+    return god::cast<xx::semaphore_impl*>(_p)->acquire(n, ms);
+}
+
+void semaphore::release(uint32 n) const {
+    god::cast<xx::semaphore_impl*>(_p)->release(n);
+}
+
+uint32 semaphore::available() const {
+    return god::cast<xx::semaphore_impl*>(_p)->available();
+}
+
 wait_group::wait_group(uint32 n) {
     _p = co::alloc(sizeof(xx::event_impl), co::cache_line_size);
     new (_p) xx::event_impl(false, false, n);
@@ -1084,4 +2335,24 @@ size_t pool::size() const {
     return god::cast<xx::pool_impl*>(_p)->size();
 }
 
+void pool::set_shared_cap(size_t cap) const {
+    god::cast<xx::pool_impl*>(_p)->set_shared_cap(cap);
+}
+
+void pool::set_idle_timeout(uint32 ms) const {
+    god::cast<xx::pool_impl*>(_p)->set_idle_timeout(ms);
+}
+
+void pool::set_health_check(std::function<bool(void*)>&& hcb) const {
+    god::cast<xx::pool_impl*>(_p)->set_health_check(std::move(hcb));
+}
+
+void pool::evict() const {
+    god::cast<xx::pool_impl*>(_p)->evict();
+}
+
+pool_stats pool::stats() const {
+    return god::cast<xx::pool_impl*>(_p)->stats();
+}
+
 } // co
@@ -1,6 +1,7 @@
 #ifdef __linux__
 #include "epoll.h"
 #include "../close.h"
+#include <sys/eventfd.h>
 
 namespace co {
 
@@ -9,13 +10,15 @@ Epoll::Epoll(int sched_id) : _signaled(0), _sched_id(sched_id) {
     CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
     co::set_cloexec(_ep);
 
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(_efd, -1) << "create eventfd error: " << co::strerror();
 
-    // register ev_read for _pipe_fds[0] to this epoll.
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], 0));
+    // register ev_read for the eventfd to this epoll.
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = _efd;
+    CHECK_EQ(epoll_ctl(_ep, EPOLL_CTL_ADD, _efd, &ev), 0)
+        << "epoll add eventfd error: " << co::strerror();
 
     _ev = (epoll_event*) ::calloc(1024, sizeof(epoll_event));
 }
@@ -25,95 +28,78 @@ Epoll::~Epoll() {
     if (_ev) { ::free(_ev); _ev = 0; }
 }
 
-bool Epoll::add_ev_read(int fd, int32 co_id) {
-    if (fd < 0) return false;
-    auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_ev_read()) return true; // already exists
+bool Epoll::_register(int fd, SockCtx& ctx, bool rearm) {
+    const bool registered = ctx.is_registered(_sched_id);
+    if (registered && !rearm) return true;
 
-    const bool has_ev_write = ctx.has_ev_write(_sched_id);
     epoll_event ev;
-    ev.events = has_ev_write ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLET);
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
     ev.data.fd = fd;
+    int r;
+    if (registered) {
+        r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
+        if (r == 0) return true;
+        // ENOENT: the fd was closed without del_event(), and its number was 
+        // reused by another socket, add it again.
+        if (errno != ENOENT) goto err;
+    }
 
-    const int r = epoll_ctl(_ep, has_ev_write ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+    // The socket may have been registered to this epoll by another coroutine 
+    // of this scheduler. EEXIST is ok here.
+    r = epoll_ctl(_ep, EPOLL_CTL_ADD, fd, &ev);
+    if (r != 0 && errno == EEXIST) r = rearm ? epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev) : 0;
     if (r == 0) {
-        ctx.add_ev_read(_sched_id, co_id);
+        ctx.set_registered(_sched_id);
         return true;
-    } else {
-        ELOG << "epoll add ev read error: " << co::strerror() << ", fd: " << fd << ", co: " << co_id;
-        return false;
     }
+
+  err:
+    ELOG << "epoll add fd error: " << co::strerror() << ", fd: " << fd;
+    return false;
 }
 
-bool Epoll::add_ev_write(int fd, int32 co_id) {
+bool Epoll::add_ev_read(int fd, int32 co_id, bool rearm) {
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_ev_write()) return true; // already exists
-
-    const bool has_ev_read = ctx.has_ev_read(_sched_id);
-    epoll_event ev;
-    ev.events = has_ev_read ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLOUT | EPOLLET);
-    ev.data.fd = fd;
+    if (ctx.has_ev_read()) return true; // already exists
 
-    const int r = epoll_ctl(_ep, has_ev_read ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
-    if (r == 0) {
-        ctx.add_ev_write(_sched_id, co_id);
-        return true;
-    } else {
-        ELOG << "epoll add ev write error: " << co::strerror() << ", fd: " << fd << ", co: " << co_id;
-        return false;
-    }
+    if (!this->_register(fd, ctx, rearm)) return false;
+    ctx.add_ev_read(_sched_id, co_id);
+    return true;
 }
 
-void Epoll::del_ev_read(int fd) {
-    if (fd < 0) return;
+bool Epoll::add_ev_write(int fd, int32 co_id, bool rearm) {
+    if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
-    if (!ctx.has_ev_read()) return; // not exists
+    if (ctx.has_ev_write()) return true; // already exists
 
-    int r;
-    ctx.del_ev_read();
-    if (!ctx.has_ev_write(_sched_id)) {
-        r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-    } else {
-        epoll_event ev;
-        ev.events = EPOLLOUT | EPOLLET;
-        ev.data.fd = fd;
-        r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
-    }
+    if (!this->_register(fd, ctx, rearm)) return false;
+    ctx.add_ev_write(_sched_id, co_id);
+    return true;
+}
 
-    if (r != 0 && errno != ENOENT) {
-        ELOG << "epoll del ev_read error: " << co::strerror() << ", fd: " << fd;
-    }
+// the socket stays in epoll, we just remove the waiting coroutine.
+void Epoll::del_ev_read(int fd) {
+    if (fd < 0) return;
+    co::get_sock_ctx(fd).del_ev_read();
 }
 
 void Epoll::del_ev_write(int fd) {
     if (fd < 0) return;
-    auto& ctx = co::get_sock_ctx(fd);
-    if (!ctx.has_ev_write()) return; // not exists
-
-    int r;
-    ctx.del_ev_write();
-    if (!ctx.has_ev_read(_sched_id)) {
-        r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-    } else {
-        epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = fd;
-        r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
-    }
-
-    if (r != 0 && errno != ENOENT) {
-        ELOG << "epoll del ev_write error: " << co::strerror() << ", fd: " << fd;
-    }
+    co::get_sock_ctx(fd).del_ev_write();
 }
 
 void Epoll::del_event(int fd) {
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_event()) {
-        ctx.del_event();
+    const bool registered = ctx.is_registered(_sched_id);
+    ctx.del_event();
+    // epoll of other schedulers drop the socket when it is closed
+    if (registered) {
         const int r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-        if (r != 0) ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        if (r != 0 && errno != ENOENT) {
+            ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        }
     }
 }
 
@@ -126,23 +112,18 @@ inline void closesocket(int& fd) {
 
 void Epoll::close() {
     co::closesocket(_ep);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
+    co::closesocket(_efd);
 }
 
 void Epoll::handle_ev_pipe() {
-    int32 dummy;
+    // reading the eventfd resets its counter, all signals are merged into one.
+    uint64 v;
     while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
-            break;
-        }
+        const int r = (int) __sys_api(read)(_efd, &v, sizeof(v));
+        if (r != -1 || errno == EWOULDBLOCK || errno == EAGAIN) break;
+        if (errno == EINTR) continue;
+        ELOG << "eventfd read error: " << co::strerror() << ", fd: " << _efd;
+        break;
     }
     atomic_store(&_signaled, 0, mo_release);
 }
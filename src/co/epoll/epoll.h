@@ -14,20 +14,24 @@ namespace co {
  *   - We have to consider about that two different coroutines operates on the 
  *     same socket, one for read and one for write. 
  * 
- *     We use data.u64 of epoll_event to store the user data: 
- *       - the higher 32 bits:  id of the coroutine waiting for EV_read. 
- *       - the lower  32 bits:  id of the coroutine waiting for EV_write. 
+ *     A socket is registered to epoll with EPOLLIN | EPOLLOUT | EPOLLET when a 
+ *     coroutine waits on it for the first time, and it stays registered until 
+ *     it is closed. The SockCtx only records ids of the coroutines waiting for 
+ *     EV_read or EV_write, and no more epoll_ctl is needed for later waits. 
  * 
- *     When an IO event is present, id in the user data will be used to resume 
- *     the corresponding coroutine.
+ *     When an IO event is present, id in the SockCtx will be used to resume 
+ *     the corresponding coroutine. As the registration is edge-triggered, a 
+ *     coroutine MUST wait only after the IO operation returned EAGAIN.
  */
 class Epoll {
   public:
     Epoll(int sched_id);
     ~Epoll();
 
-    bool add_ev_read(int fd, int32 co_id);
-    bool add_ev_write(int fd, int32 co_id);
+    // If @rearm is true, a socket already in epoll is modified with EPOLL_CTL_MOD, 
+    // which makes epoll report its current state, as a level-triggered epoll.
+    bool add_ev_read(int fd, int32 co_id, bool rearm=false);
+    bool add_ev_write(int fd, int32 co_id, bool rearm=false);
     void del_ev_read(int fd);
     void del_ev_write(int fd);
     void del_event(int fd);
@@ -36,23 +40,30 @@ class Epoll {
         return __sys_api(epoll_wait)(_ep, _ev, 1024, ms);
     }
 
-    // write one byte to the pipe to wake up the epoll.
-    void signal(char c = 'x') {
+    // Add 1 to the eventfd to wake up the epoll. Only the first signal since 
+    // the last handle_ev_pipe() does the syscall, others are merged into it.
+    void signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
-            const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            const uint64 v = 1;
+            const int r = (int) __sys_api(write)(_efd, &v, sizeof(v));
+            ELOG_IF(r != sizeof(v)) << "eventfd write error: " << co::strerror();
         }
     }
 
+    int fd() const { return _ep; }
+
     const epoll_event& operator[](int i)   const { return _ev[i]; }
     int user_data(const epoll_event& ev)         { return ev.data.fd; }
-    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _pipe_fds[0]; }
+    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _efd; }
     void handle_ev_pipe();
     void close();
 
+  private:
+    bool _register(int fd, SockCtx& ctx, bool rearm);
+
   private:
     int _ep;
-    int _pipe_fds[2];
+    int _efd; // eventfd for waking up the epoll
     int _signaled;
     int _sched_id;
     epoll_event* _ev;
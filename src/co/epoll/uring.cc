@@ -0,0 +1,157 @@
+#ifdef __linux__
+#include "uring.h"
+
+#ifdef CO_IO_URING
+#include "co/co.h"
+#include "co/log.h"
+#include "../close.h"
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <time.h>
+
+namespace co {
+
+inline int io_uring_setup(uint32 entries, io_uring_params* p) {
+    return (int) ::syscall(__NR_io_uring_setup, entries, p);
+}
+
+inline int io_uring_enter(int fd, uint32 to_submit, uint32 min_complete, uint32 flags, void* arg, size_t argsz) {
+    return (int) ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+Uring::Uring(int sched_id)
+    : _fd(-1), _sched_id(sched_id), _pending(0), _sq_ring(MAP_FAILED) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+  #ifdef IORING_SETUP_COOP_TASKRUN
+    // run task work only when the scheduler enters the kernel (linux 5.19)
+    p.flags |= IORING_SETUP_COOP_TASKRUN;
+  #endif
+
+    _fd = io_uring_setup(1024, &p);
+    if (_fd == -1 && errno == EINVAL && p.flags != IORING_SETUP_CLAMP) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CLAMP;
+        _fd = io_uring_setup(1024, &p);
+    }
+    if (_fd == -1) {
+        WLOG << "io_uring setup error: " << co::strerror() << ", sched: " << sched_id;
+        return;
+    }
+
+    const uint32 required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                            IORING_FEAT_FAST_POLL | IORING_FEAT_EXT_ARG;
+    if ((p.features & required) != required) {
+        WLOG << "io_uring features not supported: " << (~p.features & required);
+        goto err;
+    }
+
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32);
+    {
+        const size_t n = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (_sq_ring_size < n) _sq_ring_size = n;
+    }
+
+    _sq_ring = ::mmap(0, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) goto mmap_err;
+    _sqes = (io_uring_sqe*) ::mmap(
+        0, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES
+    );
+    if (_sqes == MAP_FAILED) goto mmap_err;
+
+    {
+        char* const s = (char*)_sq_ring;
+        _sq_head = (uint32*)(s + p.sq_off.head);
+        _sq_tail = (uint32*)(s + p.sq_off.tail);
+        _sq_array = (uint32*)(s + p.sq_off.array);
+        _sq_mask = *(uint32*)(s + p.sq_off.ring_mask);
+        _sq_entries = p.sq_entries;
+        _cq_head = (uint32*)(s + p.cq_off.head);
+        _cq_tail = (uint32*)(s + p.cq_off.tail);
+        _cq_mask = *(uint32*)(s + p.cq_off.ring_mask);
+        _cqes = (io_uring_cqe*)(s + p.cq_off.cqes);
+    }
+    return;
+
+  mmap_err:
+    WLOG << "io_uring mmap error: " << co::strerror() << ", sched: " << sched_id;
+  err:
+    if (_sq_ring != MAP_FAILED) { ::munmap(_sq_ring, _sq_ring_size); _sq_ring = MAP_FAILED; }
+    _close_nocancel(_fd);
+    _fd = -1;
+}
+
+Uring::~Uring() {
+    if (_fd != -1) {
+        ::munmap(_sqes, (_sq_mask + 1) * sizeof(io_uring_sqe));
+        ::munmap(_sq_ring, _sq_ring_size);
+        _close_nocancel(_fd);
+        _fd = -1;
+    }
+}
+
+int Uring::_submit(uint32 min_complete, uint32 flags, void* arg, size_t argsz) {
+    do {
+        const int r = io_uring_enter(_fd, _pending, min_complete, flags, arg, argsz);
+        if (r >= 0) {
+            _pending -= (uint32)r;
+            return r;
+        }
+        if (errno != EINTR) return -1;
+    } while (true);
+}
+
+io_uring_sqe* Uring::get_sqe() {
+    uint32 tail = *_sq_tail;
+    while (tail - atomic_load(_sq_head, mo_acquire) >= _sq_entries) {
+        // the submission queue is full, submit sqes to the kernel
+        const int r = this->_submit(0, 0, 0, 0);
+        ELOG_IF(r == -1) << "io_uring submit error: " << co::strerror() << ", sched: " << _sched_id;
+    }
+
+    const uint32 i = tail & _sq_mask;
+    io_uring_sqe* const sqe = &_sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[i] = i;
+    atomic_store(_sq_tail, tail + 1, mo_release);
+    ++_pending;
+    return sqe;
+}
+
+int Uring::wait(uint32 ms) {
+    uint32 n = atomic_load(_cq_tail, mo_acquire) - *_cq_head;
+    if (n > 0 && _pending == 0) return (int)n;
+
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (ms != (uint32)-1) {
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000;
+        arg.ts = (uint64)(size_t)&ts;
+    }
+
+    // do not wait if there are cqes ready already
+    const uint32 min_complete = (n > 0 || ms == 0) ? 0 : 1;
+    const int r = this->_submit(
+        min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)
+    );
+    if (r == -1 && errno != ETIME && errno != EBUSY) return -1;
+    return (int)(atomic_load(_cq_tail, mo_acquire) - *_cq_head);
+}
+
+void Uring::add_poll(int fd) {
+    io_uring_sqe* const sqe = this->get_sqe();
+    prep_sqe(sqe, IORING_OP_POLL_ADD, fd, 0, 0, 0);
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = ud_poll;
+}
+
+} // co
+
+#endif
+#endif
@@ -0,0 +1,94 @@
+#ifdef __linux__
+#pragma once
+
+#include "co/def.h"
+#include "co/atomic.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// IORING_FEAT_EXT_ARG (linux 5.11) is required for waiting with a timeout.
+#ifdef IORING_FEAT_EXT_ARG
+#define CO_IO_URING 1
+
+namespace co {
+
+/**
+ * io_uring for Linux
+ *   - Operations like recv or send are put into the submission queue by the
+ *     coroutines, and they will be submitted to the kernel in batch when the
+ *     scheduler waits for completions.
+ *
+ *     user_data of a sqe is the coroutine waiting for it. When the operation
+ *     is completed, the coroutine will be resumed by the scheduler.
+ *
+ *   - The epoll fd is polled in the ring, so IO events added to epoll, and the
+ *     signal to wake up the scheduler still work in io_uring mode.
+ */
+class Uring {
+  public:
+    // user_data of cqes for polling the epoll fd
+    static const uint64 ud_poll = 1;
+
+    explicit Uring(int sched_id);
+    ~Uring();
+
+    // false if io_uring is not supported by the kernel
+    bool valid() const { return _fd != -1; }
+
+    // get an empty sqe, pending sqes will be submitted if the queue is full
+    io_uring_sqe* get_sqe();
+
+    // Submit pending sqes and wait for completions.
+    //   - Return number of cqes ready, or -1 on error.
+    int wait(uint32 ms);
+
+    // get the ith cqe ready
+    const io_uring_cqe& operator[](int i) const {
+        return _cqes[(*_cq_head + i) & _cq_mask];
+    }
+
+    // mark the first n cqes as consumed
+    void consume(int n) {
+        atomic_store(_cq_head, *_cq_head + n, mo_release);
+    }
+
+    // poll @fd for readable, a cqe with user_data ud_poll will be generated
+    void add_poll(int fd);
+
+  private:
+    int _submit(uint32 min_complete, uint32 flags, void* arg, size_t argsz);
+
+  private:
+    int _fd;
+    int _sched_id;
+    uint32 _pending;   // sqes not submitted yet
+    uint32 _sq_mask;
+    uint32 _sq_entries;
+    uint32 _cq_mask;
+    uint32* _sq_head;
+    uint32* _sq_tail;
+    uint32* _sq_array;
+    uint32* _cq_head;
+    uint32* _cq_tail;
+    io_uring_sqe* _sqes;
+    io_uring_cqe* _cqes;
+    void* _sq_ring;      // the sq ring and cq ring share the same memory
+    size_t _sq_ring_size;
+};
+
+inline void prep_sqe(io_uring_sqe* sqe, uint8 op, int fd, const void* addr, uint32 len, uint64 off) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64)(size_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+}
+
+} // co
+
+#endif
+#endif
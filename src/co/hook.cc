@@ -209,11 +209,18 @@ inline void set_non_blocking(int fd, int x) {
     __sys_api(ioctl)(fd, FIONBIO, (char*)&x);
 }
 
+// A new fd may take the number of an fd closed without the hook, clear the 
+// epoll state left by the old one.
+inline void on_new_fd(int fd) {
+    co::get_sock_ctx(fd).del_event();
+}
+
 int _hook(socket)(int domain, int type, int protocol) {
     _hook_api(socket);
     int s = __sys_api(socket)(domain, type, protocol);
     auto ctx = g_hook->get_hook_ctx(s);
     if (ctx) {
+        on_new_fd(s);
         ctx->set_sock_or_pipe();
       #ifdef SOCK_NONBLOCK
         if (type & SOCK_NONBLOCK) ctx->set_non_blocking(1);
@@ -227,6 +234,8 @@ int _hook(socketpair)(int domain, int type, int protocol, int sv[2]) {
     _hook_api(socketpair);
     int r = __sys_api(socketpair)(domain, type, protocol, sv);
     if (r == 0) {
+        on_new_fd(sv[0]);
+        on_new_fd(sv[1]);
         auto ctx0 = g_hook->get_hook_ctx(sv[0]);
         auto ctx1 = g_hook->get_hook_ctx(sv[1]);
         ctx0->set_sock_or_pipe();
@@ -246,6 +255,8 @@ int _hook(pipe)(int fds[2]) {
     _hook_api(pipe);
     int r = __sys_api(pipe)(fds);
     if (r == 0) {
+        on_new_fd(fds[0]);
+        on_new_fd(fds[1]);
         g_hook->get_hook_ctx(fds[0])->set_sock_or_pipe();
         g_hook->get_hook_ctx(fds[1])->set_sock_or_pipe();
         HOOKLOG << "hook pipe, fd: " << fds[0] << ", " << fds[1];
@@ -257,6 +268,8 @@ int _hook(pipe2)(int fds[2], int flags) {
     _hook_api(pipe2);
     int r = __sys_api(pipe2)(fds, flags);
     if (r == 0) {
+        on_new_fd(fds[0]);
+        on_new_fd(fds[1]);
         auto ctx0 = g_hook->get_hook_ctx(fds[0]);
         auto ctx1 = g_hook->get_hook_ctx(fds[1]);
         const int nb = !!(flags & O_NONBLOCK);
@@ -294,6 +307,7 @@ int _hook(fcntl)(int fd, int cmd, ... /* arg */) {
             ctx->set_non_blocking(nb);
             HOOKLOG << "hook fcntl F_SETFL, fd: " << fd << ", non_block: " << nb;
         } else if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
+            on_new_fd(r);
             *g_hook->get_hook_ctx(r) = *ctx;
             HOOKLOG << "hook fcntl F_DUPFD, fd: " << fd << ", r: " << r;
         }
@@ -351,6 +365,7 @@ int _hook(dup)(int oldfd) {
 
     int r = __sys_api(dup)(oldfd);
     if (r != -1) {
+        on_new_fd(r);
         auto ctx = g_hook->get_hook_ctx(oldfd);
         if (ctx->is_sock_or_pipe()) {
             *g_hook->get_hook_ctx(r) = *ctx;
@@ -367,6 +382,7 @@ int _hook(dup2)(int oldfd, int newfd) {
 
     int r = __sys_api(dup2)(oldfd, newfd);
     if (r != -1 && oldfd != newfd) {
+        co::get_sock_ctx(newfd).del_event(); // newfd was closed silently
         *g_hook->get_hook_ctx(newfd) = *g_hook->get_hook_ctx(oldfd);
     }
 
@@ -381,6 +397,7 @@ int _hook(dup3)(int oldfd, int newfd, int flags) {
 
     int r = __sys_api(dup3)(oldfd, newfd, flags);
     if (r != -1) {
+        co::get_sock_ctx(newfd).del_event(); // newfd was closed silently
         *g_hook->get_hook_ctx(newfd) = *g_hook->get_hook_ctx(oldfd);
     }
 
@@ -417,6 +434,9 @@ int _hook(close)(int fd) {
         ctx->clear();
         r = co::close(fd);
     } else {
+        // fd like epoll fd may also be waited in coroutines, and was registered
+        // to epoll of the scheduler. It will be removed from epoll on close.
+        co::get_sock_ctx(fd).del_event();
         r = __sys_api(close)(fd);
     }
 
@@ -511,7 +531,10 @@ int _hook(accept)(int fd, struct sockaddr* addr, socklen_t* addrlen) {
     }
 
   end:
-    if (r != -1) g_hook->get_hook_ctx(r)->set_sock_or_pipe();
+    if (r != -1) {
+        on_new_fd(r);
+        g_hook->get_hook_ctx(r)->set_sock_or_pipe();
+    }
     HOOKLOG << "hook accept, fd: " << fd << ", r: " << r;
     return r;
 }
@@ -748,17 +771,24 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
             auto ctx = g_hook->get_hook_ctx(fd);
             if (!ctx || !ctx->is_sock_or_pipe() || !ctx->is_non_blocking()) break;
 
+            co::_ev_t ev;
             if (fds[0].events == POLLIN) {
-                if (!sched->add_io_event(fd, co::ev_read)) break;
+                ev = co::ev_read;
             } else if (fds[0].events == POLLOUT) {
-                if (!sched->add_io_event(fd, co::ev_write)) break;
+                ev = co::ev_write;
             } else {
                 break;
             }
 
+            // the fd is registered to epoll in edge-triggered mode, and it may 
+            // be ready already, check it first.
+            r = __sys_api(poll)(fds, nfds, 0);
+            if (r != 0) goto end;
+            if (!sched->add_io_event(fd, ev)) break;
+
             if (ms > 0) sched->add_timer(ms);
             sched->yield();
-            sched->del_io_event(fd);
+            sched->del_io_event(fd, ev);
             if (ms > 0 && sched->timeout()) { r = 0; goto end; }
 
             fds[0].revents = fds[0].events;
@@ -931,6 +961,10 @@ int _hook(epoll_wait)(int epfd, struct epoll_event* events, int n, int ms) {
     }
 
     {
+        // epfd is registered to epoll in edge-triggered mode, check it first.
+        r = __sys_api(epoll_wait)(epfd, events, n, 0);
+        if (r != 0) goto end;
+
         co::io_event ev(epfd, co::ev_read);
         if (!ev.wait(ms)) { r = 0; goto end; } // timeout
         r = __sys_api(epoll_wait)(epfd, events, n, 0);
@@ -970,6 +1004,7 @@ int _hook(accept4)(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags)
 
   end:
     if (r != -1) {
+        on_new_fd(r);
         auto c = g_hook->get_hook_ctx(r);
         c->set_sock_or_pipe();
         c->set_non_blocking(flags & SOCK_NONBLOCK);
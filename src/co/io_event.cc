@@ -58,7 +58,7 @@ io_event::io_event(sock_t fd, _ev_t ev, const void* buf, int size, int n)
     : _fd(fd), _to(0), _nb_tcp(0), _timeout(false) {
     const auto sched = xx::gSched;
     sched->add_io_event(fd, ev);
-    if (!sched->on_stack(buf)) {
+    if (!sched->on_shared_stack(buf)) {
         _info = (PerIoInfo*) co::alloc(sizeof(PerIoInfo) + n, co::cache_line_size);
         memset(_info, 0, sizeof(PerIoInfo) + n);
         _info->mlen = sizeof(PerIoInfo) + n;
@@ -1,12 +1,27 @@
 #include "sched.h"
 #include "co/os.h"
 #include "co/rand.h"
+#include "co/str.h"
+#include <algorithm>
 #include <mutex>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 DEF_uint32(co_sched_num, os::cpunum(), ">>#1 number of coroutine schedulers");
 DEF_uint32(co_stack_num, 8, ">>#1 number of stacks per scheduler, must be power of 2");
 DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines");
+DEF_bool(co_dedicated_stack, false, ">>#1 run coroutines on dedicated stacks, no stack copying on context switch, but more memory is used");
+DEF_uint32(co_dedicated_stack_size, 256 * 1024, ">>#1 size of a dedicated stack, memory is committed on demand");
 DEF_bool(co_sched_log, false, ">>#1 print logs for coroutine schedulers");
+DEF_string(co_sched_affinity, "", ">>#1 bind schedulers to cpus: compact, scatter, or a cpu list like 0-3,8,9. Do not bind if empty");
+DEF_bool(co_steal, false, ">>#1 enable work stealing, idle schedulers may steal tasks not started from others");
+DEF_uint32(co_busy_poll, 0, ">>#1 time(us) a scheduler busy polls for tasks and IO events before it sleeps in epoll, 0 to disable. SO_BUSY_POLL is also set on sockets on linux");
+DEF_uint32(co_time_slice, 10, ">>#1 time slice(ms) of a coroutine, co::maybe_yield() yields when it is used up, 0 to disable");
+DEF_uint32(co_stall_ms, 0, ">>#1 log the coroutine id and stack trace when a scheduler is blocked by a coroutine for more than N ms, 0 to disable");
+DEF_bool(co_io_uring, false, ">>#1 use io_uring for co::recv, co::send, co::accept and co::connect on linux, fall back to epoll if not supported");
+DEF_uint32(co_mutex_spin, 100, ">>#1 max number of times co::mutex spins before the coroutine is parked, 0 to disable");
 
 #ifdef _MSC_VER
 extern LONG WINAPI _co_on_exception(PEXCEPTION_POINTERS p);
@@ -27,29 +42,71 @@ co::table<SockCtx>* g_ctx_tb;
 namespace xx {
 
 __thread Sched* gSched = 0;
+__thread tq_node* g_tq_cache = 0;
+
+// Free the cached nodes when the thread exits.
+struct TqCacheGuard {
+    ~TqCacheGuard() {
+        for (tq_node* h = g_tq_cache; h;) {
+            tq_node* const x = h;
+            h = h->next;
+            co::free(x, sizeof(tq_node));
+        }
+        g_tq_cache = 0;
+    }
+};
+
+void tq_cache(tq_node* h) {
+    static thread_local TqCacheGuard g;
+    (void)g;
+    g_tq_cache = h;
+}
 
 Sched::Sched(uint32 id, uint32 sched_num, uint32 stack_num, uint32 stack_size)
     : _cputime(0), _task_mgr(), _timer_mgr(), _wait_ms(-1), _timeout(false),
       _bufs(128), _co_pool(), _running(0), _id(id), _sched_num(sched_num),
-      _stack_num(stack_num), _stack_size(stack_size) {
+      _stack_num(stack_num), _stack_size(stack_size), _seed(co::rand()), _cpu(-1),
+      _dedicated(FLG_co_dedicated_stack), _stack_pool(FLG_co_dedicated_stack_size), _scheds(0) {
     new(&_x.ev) co::sync_event();
     _x.epoll = co::make<Epoll>(id);
+  #ifdef CO_IO_URING
+    _x.uring = 0;
+    if (FLG_co_io_uring) {
+        _x.uring = co::make<Uring>(id);
+        if (_x.uring->valid()) {
+            _x.uring->add_poll(_x.epoll->fd());
+        } else {
+            WLOG << "io_uring not supported, use epoll instead, sched: " << id;
+            co::del(_x.uring);
+            _x.uring = 0;
+        }
+    }
+  #endif
     _x.stopped = false;
-    _main_co = _co_pool.pop(); // id 0 is reserved for _main_co
-    _main_co->sched = this;
-    _stack = (Stack*) co::zalloc(stack_num * sizeof(Stack));
+    _x.idle = false;
+    _steal.n = 0;
+    _steal.tasks = 0;
+    memset(&_stats, 0, sizeof(_stats));
+    memset(&_stats2, 0, sizeof(_stats2));
+    memset(&_slice, 0, sizeof(_slice));
+    _slice.timed = FLG_co_time_slice > 0 || FLG_co_stall_ms > 0;
+    _main_co = 0; // created in loop()
+    _stack = 0;
 }
 
 Sched::~Sched() {
     this->stop();
     co::del(_x.epoll);
+  #ifdef CO_IO_URING
+    if (_x.uring) co::del(_x.uring);
+  #endif
     _x.ev.~sync_event();
     for (size_t i = 0; i < _bufs.size(); ++i) {
         void* p = _bufs[i];
         god::cast<Buffer*>(&p)->reset();
     }
     _bufs.clear();
-    co::free(_stack, _stack_num * sizeof(Stack));
+    if (_stack) co::free(_stack, _stack_num * sizeof(Stack));
 }
 
 static int g_cnt = 0;
@@ -80,9 +137,31 @@ void Sched::main_func(tb_context_from_t from) {
   #else
     ((Coroutine*)from.priv)->sched->running()->cb->run();
   #endif // _WIN32
-    tb_context_jump(from.ctx, 0); // jump back to the from context
+    // jump back to the main context, it may have changed since the coroutine started
+    tb_context_jump(((Coroutine*)from.priv)->ctx, 0);
 }
 
+#ifdef _WIN32
+// bytes committed at the top of a dedicated stack when it is allocated
+inline size_t _stack_commit(size_t pagesize) { return 2 * pagesize; }
+
+// The system commits more pages of a dedicated stack when the guard page is 
+// touched, as it does for thread stacks, if the stack is described by the TIB. 
+// The context saves the TIB fields in its first four slots: fiber storage, 
+// deallocation stack, stack limit and stack base. tb_context_make() takes the 
+// bottom of the stack as the limit, so __chkstk would not probe the pages of 
+// a large frame, and may skip the guard page. Set the limit to the bottom of 
+// the committed pages, and the deallocation stack to the base of the 
+// reservation. The limit may be above the pages committed by a previous 
+// coroutine, which only makes __chkstk probe pages already committed.
+inline void _set_stack_limit(tb_context_t ctx, Stack* s) {
+    const size_t g = os::pagesize();
+    void** const x = (void**)ctx;
+    x[1] = s->p - g;
+    x[2] = s->top - _stack_commit(g);
+}
+#endif
+
 /*
  *  scheduling thread:
  *
@@ -99,6 +178,12 @@ void Sched::resume(Coroutine* co) {
     tb_context_from_t from;
     Stack* const s = co->stack;
     _running = co;
+    if (_slice.timed) {
+        atomic_store(&_slice.co, this->coroutine_id(), mo_relaxed);
+        atomic_store(&_slice.beg, now::us(), mo_release);
+    }
+    _count(_stats.switches);
+    s->ts = _stats.switches;
     if (s->p == 0) {
         s->p = (char*) co::alloc(_stack_size);
         s->top = s->p + _stack_size;
@@ -108,7 +193,10 @@ void Sched::resume(Coroutine* co) {
     if (co->ctx == 0) {
         // resume new coroutine
         if (s->co != co) { this->save_stack(s->co); s->co = co; }
-        co->ctx = tb_context_make(s->p, _stack_size, main_func);
+        co->ctx = tb_context_make(s->p, s->top - s->p, main_func);
+      #ifdef _WIN32
+        if (s->dedicated) _set_stack_limit(co->ctx, s);
+      #endif
         SCHEDLOG << "resume new co: " << co << " id: " << co->id;
         from = tb_context_jump(co->ctx, _main_co); // jump to main_func(from):  from.priv == _main_co
 
@@ -126,10 +214,13 @@ void Sched::resume(Coroutine* co) {
             this->save_stack(s->co);
             CHECK_EQ(s->top, (char*)co->ctx + co->buf.size());
             memcpy(co->ctx, co->buf.data(), co->buf.size()); // restore stack data
+            _count(_stats.copies);
+            _count(_stats.restored, co->buf.size());
             s->co = co;
         }
         from = tb_context_jump(co->ctx, _main_co); // jump back to where yiled() was called
     }
+    if (_slice.timed) atomic_store(&_slice.beg, (int64)0, mo_relaxed);
 
     if (from.priv) {
         // yield() was called in the coroutine, update context for it
@@ -145,12 +236,43 @@ void Sched::resume(Coroutine* co) {
 
 void Sched::loop() {
     gSched = this;
+    atomic_store(&_slice.tid, co::thread_id(), mo_relaxed);
+    if (_cpu >= 0) {
+        // bind the cpu before anything is allocated in this thread, memory will 
+        // come from the NUMA node of the cpu when it is first touched.
+        if (os::bind_cpu(_cpu)) {
+            SCHEDLOG << "sched " << _id << " bound to cpu " << _cpu;
+        } else {
+            WLOG << "sched " << _id << " bind to cpu " << _cpu << " failed: " << co::strerror();
+        }
+    }
+    _main_co = _co_pool.pop(); // id 0 is reserved for _main_co
+    _main_co->sched = this;
+    _stack = (Stack*) co::zalloc(_stack_num * sizeof(Stack));
+    _timer_mgr.init();
     co::vector<Closure*> new_tasks(512);
     co::vector<Coroutine*> ready_tasks(512);
     co::Timer timer;
+    size_t loose = 0;
 
     while (!_x.stopped) {
-        int n = _x.epoll->wait(_wait_ms);
+        int n = 0;
+        if (_wait_ms != 0 && FLG_co_busy_poll > 0) n = this->busy_poll();
+        if (n == 0) {
+            if (_wait_ms != 0) {
+                atomic_store(&_x.idle, true);
+                if (!_task_mgr.empty()) _wait_ms = 0;
+            }
+            if (_wait_ms != 0) {
+                const int64 t = now::us();
+                n = this->poll(_wait_ms);
+                _count(_stats2.sleep_us, now::us() - t);
+                _count(_stats.wakeups);
+            } else {
+                n = this->poll(0);
+            }
+            if (_x.idle) atomic_store(&_x.idle, false, mo_relaxed);
+        }
         if (_x.stopped) break;
 
         if (unlikely(n == -1)) {
@@ -160,42 +282,27 @@ void Sched::loop() {
 
         if (_sched_num > 1) timer.restart();
         SCHEDLOG << "> check I/O tasks ready to resume, num: " << n;
-
-        for (int i = 0; i < n; ++i) {
-            auto& ev = (*_x.epoll)[i];
-            if (_x.epoll->is_ev_pipe(ev)) {
-                _x.epoll->handle_ev_pipe();
-                continue;
-            }
-
-          #if defined(_WIN32)
-            auto info = xx::per_io_info(ev.lpOverlapped);
-            auto co = (Coroutine*) info->co;
-            if (atomic_bool_cas(&info->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                info->n = ev.dwNumberOfBytesTransferred;
-                if (co->sched == this) {
-                    this->resume(co);
-                } else {
-                    co->sched->add_ready_task(co);
-                }
-            } else {
-                co::free(info, info->mlen);
-            }
-          #elif defined(__linux__)
-            int32 rco = 0, wco = 0;
-            auto& ctx = co::get_sock_ctx(_x.epoll->user_data(ev));
-            if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
-            if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
-            if (rco) this->resume(&_co_pool[rco]);
-            if (wco) this->resume(&_co_pool[wco]);
-          #else
-            this->resume((Coroutine*)_x.epoll->user_data(ev));
-          #endif
+      #ifdef CO_IO_URING
+        if (_x.uring) {
+            this->handle_cqes(n);
+        } else {
+            this->handle_io_events(n);
         }
+      #else
+        this->handle_io_events(n);
+      #endif
 
         SCHEDLOG << "> check tasks ready to resume..";
         do {
-            _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            loose = _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            atomic_store(&_stats.tasks, (uint64)(new_tasks.size() + ready_tasks.size()), mo_relaxed);
+            if (loose > 0) {
+                this->wake_idle_sched();
+            } else if (FLG_co_steal && new_tasks.empty() && ready_tasks.empty() && _scheds) {
+                this->steal(new_tasks);
+            }
+
+            this->run_high_lane();
 
             if (!new_tasks.empty()) {
                 const size_t c = new_tasks.capacity();
@@ -203,6 +310,7 @@ void Sched::loop() {
                 SCHEDLOG << ">> resume new tasks, num: " << s;
                 for (size_t i = 0; i < s; ++i) {
                     this->resume(this->new_coroutine(new_tasks[i]));
+                    if ((i & 15) == 15) this->run_high_lane();
                 }
                 if (c >= 8192 && s <= (c >> 1)) {
                     co::vector<Closure*>(s).swap(new_tasks);
@@ -216,6 +324,7 @@ void Sched::loop() {
                 SCHEDLOG << ">> resume ready tasks, num: " << s;
                 for (size_t i = 0; i < s; ++i) {
                     this->resume(ready_tasks[i]);
+                    if ((i & 15) == 15) this->run_high_lane();
                 }
                 if (c >= 8192 && s <= (c >> 1)) {
                     co::vector<Coroutine*>(s).swap(ready_tasks);
@@ -230,6 +339,7 @@ void Sched::loop() {
 
             if (!ready_tasks.empty()) {
                 SCHEDLOG << ">> resume timedout tasks, num: " << ready_tasks.size();
+                _count(_stats.timers, ready_tasks.size());
                 _timeout = true;
                 for (size_t i = 0; i < ready_tasks.size(); ++i) {
                     this->resume(ready_tasks[i]);
@@ -239,6 +349,7 @@ void Sched::loop() {
             }
         } while (0);
 
+        if (loose > 0) _wait_ms = 0; // loose tasks left, do not wait in epoll
         if (_running) _running = 0;
         if (_sched_num > 1) atomic_add(&_cputime, timer.us(), mo_relaxed);
     }
@@ -246,32 +357,339 @@ void Sched::loop() {
     _x.ev.signal();
 }
 
-uint32 TimerManager::check_timeout(co::vector<Coroutine*>& res) {
-    if (_timer.empty()) return (uint32)-1;
-
-    int64 now_ms = now::ms();
-    auto it = _timer.begin();
-    for (; it != _timer.end(); ++it) {
-        if (it->first > now_ms) break;
-        Coroutine* co = it->second;
-        if (co->it != _timer.end()) co->it = _timer.end();
-        if (!co->waitx) {
-            res.push_back(co);
-        } else {
-            auto w = co->waitx;
-            // TODO: is mo_relaxed safe here?
-            if (atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
-                res.push_back(co);
+void Sched::run_high_lane() {
+    if (_task_mgr.high_empty()) return;
+    _task_mgr.get_high_tasks(_high_new, _high_ready);
+    const size_t n = _high_new.size() + _high_ready.size();
+    atomic_store(&_stats2.high_tasks, (uint64)n, mo_relaxed);
+    _count(_stats2.high_switches, n);
+    SCHEDLOG << ">> resume high priority tasks, num: " << n;
+
+    for (size_t i = 0; i < _high_new.size(); ++i) {
+        this->resume(this->new_coroutine(_high_new[i]));
+    }
+    for (size_t i = 0; i < _high_ready.size(); ++i) {
+        this->resume(_high_ready[i]);
+    }
+    _high_new.clear();
+    _high_ready.clear();
+}
+
+int Sched::busy_poll() {
+    const int64 beg = now::us();
+    const int64 budget = _wait_ms < FLG_co_busy_poll / 1000 ? _wait_ms * 1000ll : FLG_co_busy_poll;
+    int64 t = beg;
+    int n = 0;
+    do {
+        n = this->poll(0);
+        if (n != 0 || !_task_mgr.empty() || _x.stopped) break;
+        t = now::us();
+    } while (t - beg < budget);
+    _count(_stats2.spin_us, now::us() - beg);
+    return n;
+}
+
+void Sched::handle_io_events(int n) {
+    for (int i = 0; i < n; ++i) {
+        auto& ev = (*_x.epoll)[i];
+        if (_x.epoll->is_ev_pipe(ev)) {
+            _x.epoll->handle_ev_pipe();
+            _count(_stats.signals);
+            continue;
+        }
+
+      #if defined(_WIN32)
+        auto info = xx::per_io_info(ev.lpOverlapped);
+        auto co = (Coroutine*) info->co;
+        if (atomic_bool_cas(&info->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+            info->n = ev.dwNumberOfBytesTransferred;
+            if (co->sched == this) {
+                this->resume(co);
+            } else {
+                co->sched->add_ready_task(co);
             }
+        } else {
+            co::free(info, info->mlen);
+        }
+      #elif defined(__linux__)
+        int32 rco = 0, wco = 0;
+        auto& ctx = co::get_sock_ctx(_x.epoll->user_data(ev));
+        if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
+        if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
+        if (rco) this->resume(&_co_pool[rco]);
+        if (wco) this->resume(&_co_pool[wco]);
+      #else
+        this->resume((Coroutine*)_x.epoll->user_data(ev));
+      #endif
+    }
+}
+
+#ifdef CO_IO_URING
+void Sched::handle_cqes(int n) {
+    for (int i = 0; i < n; ++i) {
+        const auto& cqe = (*_x.uring)[i];
+        const uint64 ud = cqe.user_data;
+        if (ud == Uring::ud_poll) {
+            // IO events added to epoll, or signal to wake up the scheduler
+            const int m = _x.epoll->wait(0);
+            if (m > 0) this->handle_io_events(m);
+            _x.uring->add_poll(_x.epoll->fd());
+        } else if (ud != 0) {
+            Coroutine* const co = (Coroutine*)(size_t)ud;
+            co->io_res = cqe.res;
+            this->resume(co);
+        }
+    }
+    _x.uring->consume(n);
+}
+
+int Sched::uring_wait(io_uring_sqe* sqe, uint32 ms) {
+    Coroutine* const co = _running;
+    sqe->user_data = (uint64)(size_t)co;
+    if (ms != (uint32)-1) this->add_timer(ms);
+    this->yield();
+
+    if (_timeout) {
+        // cancel the operation, and wait for its completion, as the kernel may 
+        // still be using the buffers.
+        io_uring_sqe* const x = _x.uring->get_sqe();
+        prep_sqe(x, IORING_OP_ASYNC_CANCEL, -1, co, 0, 0);
+        this->yield();
+        return co->io_res == -ECANCELED ? -ETIMEDOUT : co->io_res;
+    }
+    return co->io_res;
+}
+#endif
+
+size_t Sched::steal(co::vector<Closure*>& new_tasks) {
+    const auto& v = *_scheds;
+    const uint32 n = god::cast<uint32>(v.size());
+    const uint32 i = co::rand(_seed) % n;
+    for (uint32 k = 0; k < n; ++k) {
+        Sched* const s = v[i + k < n ? i + k : i + k - n];
+        if (s == this) continue;
+        const size_t x = s->_task_mgr.steal_tasks(new_tasks);
+        if (x > 0) {
+            SCHEDLOG << "steal " << x << " tasks from sched " << s->id();
+            atomic_inc(&_steal.n, mo_relaxed);
+            atomic_add(&_steal.tasks, x, mo_relaxed);
+            return x;
         }
     }
+    return 0;
+}
+
+void Sched::stats(co::SchedStats& s) const {
+    s.id = _id;
+    const size_t n = _co_pool.size();
+    s.coroutines = (uint32)(n > 0 ? n - 1 : 0); // _main_co not included
+    s.tasks = atomic_load(&_stats.tasks, mo_relaxed);
+    s.switches = atomic_load(&_stats.switches, mo_relaxed);
+    s.stack_copies = atomic_load(&_stats.copies, mo_relaxed);
+    s.stack_saved = atomic_load(&_stats.saved, mo_relaxed);
+    s.stack_restored = atomic_load(&_stats.restored, mo_relaxed);
+    s.timers = atomic_load(&_stats.timers, mo_relaxed);
+    s.wakeups = atomic_load(&_stats.wakeups, mo_relaxed);
+    s.signals = atomic_load(&_stats.signals, mo_relaxed);
+    s.steals = this->steals();
+    s.stolen_tasks = this->stolen_tasks();
+    s.cputime = atomic_load(&_cputime, mo_relaxed);
+    s.spin_us = atomic_load(&_stats2.spin_us, mo_relaxed);
+    s.sleep_us = atomic_load(&_stats2.sleep_us, mo_relaxed);
+    s.high_tasks = atomic_load(&_stats2.high_tasks, mo_relaxed);
+    s.high_switches = atomic_load(&_stats2.high_switches, mo_relaxed);
+}
 
-    if (it != _timer.begin()) {
-        if (_it != _timer.end() && _it->first <= now_ms) _it = it;
-        _timer.erase(_timer.begin(), it);
+void Sched::wake_idle_sched() {
+    if (!FLG_co_steal || !_scheds) return;
+    const auto& v = *_scheds;
+    const uint32 n = god::cast<uint32>(v.size());
+    const uint32 i = co::rand(_seed) % n;
+    for (uint32 k = 0; k < n; ++k) {
+        Sched* const s = v[i + k < n ? i + k : i + k - n];
+        if (s != this && atomic_load(&s->_x.idle, mo_relaxed)) {
+            s->_x.epoll->signal();
+            return;
+        }
     }
+}
+
+#ifdef _WIN32
+// Reserve the stack, and commit only the top pages with a guard page below. 
+// The lowest @guard bytes are never committed.
+inline char* _stack_alloc(size_t n, size_t guard) {
+    char* p = (char*) VirtualAlloc(NULL, n, MEM_RESERVE, PAGE_NOACCESS);
+    if (p) {
+        const size_t c = _stack_commit(guard);
+        if (!VirtualAlloc(p + n - c, c, MEM_COMMIT, PAGE_READWRITE) ||
+            !VirtualAlloc(p + n - c - guard, guard, MEM_COMMIT, PAGE_READWRITE | PAGE_GUARD)) {
+            VirtualFree(p, 0, MEM_RELEASE);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+inline void _stack_free(char* p, size_t) {
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+inline char* _stack_alloc(size_t n, size_t guard) {
+    char* p = (char*) ::mmap(
+        NULL, n, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    if (p == (char*)MAP_FAILED) return NULL;
+    ::mprotect(p, guard, PROT_NONE);
+    return p;
+}
 
-    return _timer.empty() ? (uint32)-1 : (uint32)(_timer.begin()->first - now_ms);
+inline void _stack_free(char* p, size_t n) {
+    ::munmap(p, n);
+}
+#endif
+
+StackPool::~StackPool() {
+    const size_t g = os::pagesize();
+    for (size_t i = 0; i < _v.size(); ++i) {
+        _stack_free(_v[i]->p - g, _size + g);
+        co::free(_v[i], sizeof(Stack));
+    }
+    _v.clear();
+}
+
+Stack* StackPool::pop(Coroutine* co) {
+    Stack* s;
+    if (!_v.empty()) {
+        s = _v.pop_back();
+    } else {
+        const size_t g = os::pagesize();
+        char* const p = _stack_alloc(_size + g, g);
+        CHECK(p) << "allocate dedicated stack failed: " << co::strerror();
+        s = (Stack*) co::alloc(sizeof(Stack)); assert(s);
+        s->p = p + g;
+        s->top = s->p + _size;
+        s->dedicated = true;
+    }
+    s->co = co;
+    return s;
+}
+
+void StackPool::push(Stack* s) {
+    if (_v.size() < M) {
+        _v.push_back(s);
+    } else {
+        const size_t g = os::pagesize();
+        _stack_free(s->p - g, _size + g);
+        co::free(s, sizeof(Stack));
+    }
+}
+
+#ifdef _MSC_VER
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    unsigned long r;
+    _BitScanForward(&r, x);
+    return r;
+}
+#else
+inline uint32 _find_lsb(uint32 x) { /* x != 0 */
+    return __builtin_ctz(x);
+}
+#endif
+
+void TimerManager::_insert(TimerNode* t) {
+    const int64 d = t->ms - _ms;
+    uint32 i;
+    if (d < N0) {
+        i = (uint32)((d >= 0 ? t->ms : _ms) & (N0 - 1));
+        this->_set(i);
+    } else {
+        uint32 l = 1, b = B0;
+        while (l < L - 1 && d >= ((int64)1 << (b + B))) { ++l; b += B; }
+        i = N0 + (l - 1) * N + (uint32)((t->ms >> b) & (N - 1));
+    }
+    t->slot = i;
+    _slots[i].push_back(t);
+}
+
+void TimerManager::_cascade() {
+    for (uint32 l = 1, b = B0; l < L; ++l, b += B) {
+        const uint32 k = (uint32)((_ms >> b) & (N - 1));
+        co::clist& x = _slots[N0 + (l - 1) * N + k];
+        co::clink* h = x.front();
+        x.clear();
+        while (h) {
+            TimerNode* const t = (TimerNode*)h;
+            h = h->next;
+            this->_insert(t);
+        }
+        if (k != 0) break;
+    }
+}
+
+uint32 TimerManager::_next_slot(uint32 i) const {
+    uint32 k = i >> 5;
+    uint32 x = _bits[k] & (~0u << (i & 31));
+    for (;;) {
+        if (x) return (k << 5) + _find_lsb(x);
+        if (++k == (N0 >> 5)) return N0;
+        x = _bits[k];
+    }
+}
+
+uint32 TimerManager::check_timeout(co::vector<Coroutine*>& res) {
+    if (_size == 0) return (uint32)-1;
+
+    const int64 now_ms = now::ms();
+    while (_ms <= now_ms && _size > 0) {
+        const uint32 i = (uint32)(_ms & (N0 - 1));
+        if (i == 0) this->_cascade();
+
+        const uint32 j = this->_next_slot(i);
+        if (j == N0) { /* no timer at level 0 before the next round */
+            const int64 x = (_ms | (N0 - 1)) + 1;
+            _ms = x <= now_ms ? x : now_ms + 1;
+            continue;
+        }
+        if (_ms + (j - i) > now_ms) { _ms = now_ms + 1; break; }
+        _ms += j - i;
+
+        co::clist& l = _slots[j];
+        co::clink* h = l.front();
+        l.clear();
+        this->_unset(j);
+        while (h) {
+            TimerNode* const t = (TimerNode*)h;
+            h = h->next;
+            --_size;
+            Coroutine* const co = t->co;
+            co->it = this->end();
+            if (!co->waitx) {
+                res.push_back(co);
+            } else {
+                auto w = co->waitx;
+                // TODO: is mo_relaxed safe here?
+                const uint8 s = atomic_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed);
+                if (s == st_wait) {
+                    res.push_back(co);
+                } else if (s == st_busy) {
+                    // the waiter may be released, check it again in the next ms
+                    t->ms = now_ms + 1;
+                    ++_size;
+                    this->_insert(t);
+                    co->it = t;
+                }
+            }
+        }
+        ++_ms;
+    }
+
+    if (_size == 0) return (uint32)-1;
+    const uint32 i = (uint32)(_ms & (N0 - 1));
+    const uint32 j = this->_next_slot(i);
+    const int64 x = j != N0 ? _ms + (j - i) : (_ms | (N0 - 1)) + 1;
+    return (uint32)(x - now_ms);
 }
 
 struct SchedInfo {
@@ -286,6 +704,72 @@ inline SchedInfo& sched_info() {
     return g_si ? *g_si : *(g_si = co::_make_static<SchedInfo>());
 }
 
+// Get cpus for the schedulers from FLG_co_sched_affinity, scheduler i will be 
+// bound to the ith cpu in the result, or not bound if the result is empty.
+//   - compact: fill cores of a NUMA node first, SMT siblings are adjacent.
+//   - scatter: spread schedulers across NUMA nodes and cores, SMT siblings 
+//     are used only after every core has one scheduler.
+//   - cpu list: e.g. 0-3,8,9. Cpus are reused if there are more schedulers.
+static co::vector<int> sched_cpus(uint32 n) {
+    co::vector<int> res;
+    const fastring& s = FLG_co_sched_affinity;
+    if (s.empty()) return res;
+
+    co::vector<int> v;
+    if (s == "compact" || s == "scatter") {
+        struct X { int s, r, node, core, id; };
+        const auto& cpus = os::cpus();
+        co::vector<X> x(cpus.size());
+        co::hash_map<int, int> sibling; // core -> number of cpus found
+        co::hash_map<int, int> rank;    // core -> rank of the core in its node
+        co::hash_map<int, int> ncore;   // node -> number of cores found
+        for (auto& c : cpus) {
+            const int i = sibling[c.core]++;
+            if (i == 0) rank[c.core] = ncore[c.node]++;
+            x.push_back(X{ i, rank[c.core], c.node, c.core, c.id });
+        }
+        if (s == "compact") {
+            std::sort(x.data(), x.data() + x.size(), [](const X& a, const X& b) {
+                if (a.node != b.node) return a.node < b.node;
+                if (a.r != b.r) return a.r < b.r;
+                return a.id < b.id;
+            });
+        } else {
+            std::sort(x.data(), x.data() + x.size(), [](const X& a, const X& b) {
+                if (a.s != b.s) return a.s < b.s;
+                if (a.r != b.r) return a.r < b.r;
+                if (a.node != b.node) return a.node < b.node;
+                return a.id < b.id;
+            });
+        }
+        for (auto& e : x) v.push_back(e.id);
+    } else {
+        auto l = str::split(s, ',');
+        for (auto& e : l) {
+            e.strip();
+            if (e.empty()) continue;
+            const size_t p = e.find('-');
+            const int a = str::to_int32(p == e.npos ? e : e.substr(0, p));
+            bool ok = co::error() == 0;
+            int b = a;
+            if (p != e.npos) {
+                b = str::to_int32(e.substr(p + 1));
+                ok = ok && co::error() == 0;
+            }
+            if (!ok || a < 0 || a > b) {
+                WLOG << "invalid cpu list: " << s;
+                return res;
+            }
+            for (int i = a; i <= b; ++i) v.push_back(i);
+        }
+    }
+
+    if (!v.empty()) {
+        for (uint32 i = 0; i < n; ++i) res.push_back(v[i % v.size()]);
+    }
+    return res;
+}
+
 static uint32 g_nco = 0;
 static bool g_main_thread_as_sched;
 
@@ -296,9 +780,12 @@ SchedManager::SchedManager() {
     auto& n = FLG_co_sched_num;
     auto& m = FLG_co_stack_num;
     auto& s = FLG_co_stack_size;
+    auto& d = FLG_co_dedicated_stack_size;
     if (n == 0 || n > ncpu) n = ncpu;
     if (m == 0 || (m & (m - 1)) != 0) m = 8;
     if (s == 0) s = 1024 * 1024;
+    if (d < 16 * 1024) d = 16 * 1024;
+    d = (uint32) god::align_up(d, os::pagesize());
 
     if (n != 1) {
         if ((n & (n - 1)) == 0) {
@@ -334,15 +821,53 @@ SchedManager::SchedManager() {
         _next = [](const co::vector<Sched*>& v) { return v[0]; };
     }
 
+    const auto cpus = sched_cpus(n);
     for (uint32 i = 0; i < n; ++i) {
         Sched* sched = co::_make_static<Sched>(i, n, m, s);
-        if (i != 0 || !g_main_thread_as_sched) sched->start();
+        if (!cpus.empty()) sched->set_cpu(cpus[i]);
         _scheds.push_back(sched);
     }
 
+    for (uint32 i = 0; i < n; ++i) {
+        if (n > 1) _scheds[i]->set_scheds(&_scheds);
+        if (i != 0 || !g_main_thread_as_sched) _scheds[i]->start();
+    }
+
+    if (FLG_co_stall_ms > 0) {
+        _watchdog = std::thread(&SchedManager::watchdog, this);
+    }
     is_active() = true;
 }
 
+void SchedManager::watchdog() {
+    const uint32 ms = FLG_co_stall_ms;
+    const uint32 interval = ms >= 20 ? ms / 4 : 5;
+    co::vector<int64> reported(_scheds.size(), 0);
+    fastream s(4096);
+    int64 beg;
+    int co;
+
+    while (!_ev.wait(interval)) {
+        for (size_t i = 0; i < _scheds.size(); ++i) {
+            Sched* const sched = _scheds[i];
+            if (!sched->running_since(beg, co) || beg == reported[i]) continue;
+            const int64 t = now::us() - beg;
+            if (t < (int64)ms * 1000) continue;
+
+            // report once for each resume of a coroutine
+            reported[i] = beg;
+            s.clear();
+            if (log::stack_trace(sched->thread_id(), s)) {
+                if (s.back() == '\n') s.resize(s.size() - 1);
+            } else {
+                s << "not available";
+            }
+            WLOG << "sched " << sched->id() << " blocked by co " << co << " for "
+                 << (t / 1000) << " ms without yielding, stack trace:\n" << s;
+        }
+    }
+}
+
 SchedManager::~SchedManager() {
     this->stop();
     co::cleanup_sock();
@@ -372,19 +897,79 @@ void SchedManager::stop() {
     for (size_t i = 0; i < _scheds.size(); ++i) {
         _scheds[i]->stop();
     }
+    if (_watchdog.joinable()) {
+        _ev.signal();
+        _watchdog.join();
+    }
     atomic_swap(&is_active(), false, mo_acq_rel);
 }
 
 } // xx
 
 void go(Closure* cb) {
-    xx::sched_man()->next_sched()->add_new_task(cb);
+    const auto s = xx::sched_man()->next_sched();
+    FLG_co_steal ? s->add_loose_task(cb) : s->add_new_task(cb);
+}
+
+void go_batch(Closure* const* cbs, size_t n) {
+    if (n == 0) return;
+    const auto& v = xx::sched_man()->scheds();
+    const size_t m = v.size() < n ? v.size() : n;
+    const size_t q = n / m, r = n % m;
+    const uint32 k = xx::sched_man()->next_sched()->id();
+    for (size_t i = 0; i < m; ++i) {
+        const size_t c = q + (i < r ? 1 : 0);
+        v[(k + i) % v.size()]->add_new_tasks(cbs, c, FLG_co_steal);
+        cbs += c;
+    }
+}
+
+void go_high(Closure* cb) {
+    xx::sched_man()->next_sched()->add_new_task(xx::tag_high(cb));
+}
+
+void go_dedicated(Closure* cb) {
+    const auto s = xx::sched_man()->next_sched();
+    cb = xx::tag_dedicated(cb);
+    FLG_co_steal ? s->add_loose_task(cb) : s->add_new_task(cb);
 }
 
 void co::Sched::go(Closure* cb) {
     ((xx::Sched*)this)->add_new_task(cb);
 }
 
+void co::Sched::go_batch(Closure* const* cbs, size_t n) {
+    ((xx::Sched*)this)->add_new_tasks(cbs, n, false);
+}
+
+void co::Sched::go_high(Closure* cb) {
+    ((xx::Sched*)this)->add_new_task(xx::tag_high(cb));
+}
+
+void co::Sched::go_dedicated(Closure* cb) {
+    ((xx::Sched*)this)->add_new_task(xx::tag_dedicated(cb));
+}
+
+void co::Sched::set_dedicated_stack(bool on) {
+    ((xx::Sched*)this)->set_dedicated_stack(on);
+}
+
+uint64 co::Sched::steals() const {
+    return ((const xx::Sched*)this)->steals();
+}
+
+uint64 co::Sched::stolen_tasks() const {
+    return ((const xx::Sched*)this)->stolen_tasks();
+}
+
+uint64 co::Sched::stack_copies() const {
+    return ((const xx::Sched*)this)->stack_copies();
+}
+
+uint64 co::Sched::stack_bytes() const {
+    return ((const xx::Sched*)this)->stack_bytes();
+}
+
 void co::MainSched::loop() {
     ((xx::Sched*)this)->loop();
 }
@@ -393,6 +978,14 @@ const co::vector<co::Sched*>& scheds() {
     return (co::vector<co::Sched*>&) xx::sched_man()->scheds();
 }
 
+co::vector<SchedStats> sched_stats() {
+    const auto& v = xx::sched_man()->scheds();
+    co::vector<SchedStats> res(v.size());
+    res.resize(v.size());
+    for (size_t i = 0; i < v.size(); ++i) v[i]->stats(res[i]);
+    return res;
+}
+
 int sched_num() {
     return xx::is_active() ? (int)xx::sched_man()->scheds().size() : os::cpunum();
 }
@@ -432,7 +1025,9 @@ void add_timer(uint32 ms) {
 bool add_io_event(sock_t fd, _ev_t ev) {
     const auto s = xx::gSched;
     CHECK(s) << "MUST be called in coroutine..";
-    return s->add_io_event(fd, ev);
+    // The caller may not have tried the IO operation before, re-arm the socket 
+    // so that an event reported before this wait is not missed.
+    return s->add_io_event(fd, ev, true);
 }
 
 void del_io_event(sock_t fd, _ev_t ev) {
@@ -453,6 +1048,14 @@ void yield() {
     s->yield();
 }
 
+void maybe_yield() {
+    const auto s = xx::gSched;
+    if (s && FLG_co_time_slice > 0 && s->slice_used_up((int64)FLG_co_time_slice * 1000)) {
+        s->add_ready_task(s->running());
+        s->yield();
+    }
+}
+
 void resume(void* p) {
     const auto co = (xx::Coroutine*)p;
     co->sched->add_ready_task(co);
@@ -19,6 +19,7 @@
 #include "epoll/iocp.h"
 #elif defined(__linux__)
 #include "epoll/epoll.h"
+#include "epoll/uring.h"
 #else
 #include "epoll/kqueue.h"
 #endif
@@ -26,7 +27,14 @@
 DEC_uint32(co_sched_num);
 DEC_uint32(co_stack_num);
 DEC_uint32(co_stack_size);
+DEC_bool(co_dedicated_stack);
+DEC_uint32(co_dedicated_stack_size);
 DEC_bool(co_sched_log);
+DEC_string(co_sched_affinity);
+DEC_bool(co_steal);
+DEC_bool(co_io_uring);
+DEC_uint32(co_busy_poll);
+DEC_uint32(co_mutex_spin);
 
 #define SCHEDLOG DLOG_IF(FLG_co_sched_log)
 
@@ -42,12 +50,21 @@ static SchedInitializer g_sched_initializer;
 
 class Sched;
 struct Coroutine;
-typedef co::multimap<int64, Coroutine*>::iterator timer_id_t;
+
+// node of the timing wheel, every coroutine has one
+struct TimerNode : co::clink {
+    int64 ms;      // expire time in milliseconds
+    uint32 slot;   // slot of the timing wheel this node is in
+    Coroutine* co; // the coroutine this timer belongs to
+};
+
+typedef TimerNode* timer_id_t;
 
 enum state_t : uint8 {
     st_wait = 0,    // wait for an event, do not modify
     st_ready = 1,   // ready to resume
     st_timeout = 2, // timeout
+    st_busy = 3,    // claimed tentatively, it will be st_ready or st_wait soon
 };
 
 // waiting context
@@ -68,8 +85,58 @@ struct Stack {
     char* p;       // stack pointer 
     char* top;     // stack top
     Coroutine* co; // coroutine owns this stack
+    uint64 ts;     // time (in switches) the stack was last used
+    uint32 n;      // number of coroutines bound to this shared stack
+    bool dedicated; // owned by a single coroutine, never copied
 };
 
+// Pool of dedicated stacks, each coroutine started by go_dedicated() or in a 
+// scheduler with dedicated stacks enabled owns a stack here until it ends.
+//   - A stack is reserved with mmap, and the kernel commits the pages lazily 
+//     when they are touched. The lowest page is a guard page, stack overflow 
+//     will crash the program instead of corrupting the memory silently.
+//   - Stacks of terminated coroutines are recycled, at most 256 are cached.
+class StackPool {
+  public:
+    static const uint32 M = 256;
+
+    // @size: usable size of a stack, not including the guard page
+    explicit StackPool(uint32 size) : _size(size), _v() {}
+    ~StackPool();
+
+    // pop a stack for the coroutine @co
+    Stack* pop(Coroutine* co);
+
+    void push(Stack* s);
+
+  private:
+    uint32 _size;
+    co::vector<Stack*> _v;
+};
+
+// Tags of a task are stored in the lowest bits of the pointer.
+//   - bit 0: run on a dedicated stack
+//   - bit 1: run in the high priority lane
+inline Closure* tag_dedicated(Closure* cb) {
+    return (Closure*)((size_t)cb | 1);
+}
+
+inline bool is_dedicated(Closure* cb) {
+    return ((size_t)cb & 1) != 0;
+}
+
+inline Closure* tag_high(Closure* cb) {
+    return (Closure*)((size_t)cb | 2);
+}
+
+inline bool is_high(Closure* cb) {
+    return ((size_t)cb & 2) != 0;
+}
+
+inline Closure* untag(Closure* cb) {
+    return (Closure*)((size_t)cb & ~(size_t)3);
+}
+
 struct Buffer {
     struct H {
         uint32 cap;
@@ -130,7 +197,10 @@ struct Coroutine {
         void* pbuf;
     };
     waitx_t* waitx;   // waiting context
-    union { timer_id_t it;  char _dummy2[sizeof(timer_id_t)]; };
+    timer_id_t it;    // the active timer, or NULL if there is no timer
+    TimerNode timer;  // node of the timer
+    int32 io_res;     // result of the io_uring operation
+    bool high;        // in the high priority lane
 };
 
 class CoroutinePool {
@@ -140,7 +210,7 @@ class CoroutinePool {
     static const int M = 256;
 
     CoroutinePool()
-        : _c(0), _o(0), _v(M), _use_count(M) {
+        : _c(0), _o(0), _size(0), _v(M), _use_count(M) {
         _v.resize(M);
         _use_count.resize(M);
     }
@@ -154,6 +224,7 @@ class CoroutinePool {
 
     Coroutine* pop() {
         int id = 0;
+        atomic_store(&_size, _size + 1, mo_relaxed);
         if (!_v0.empty()) { id = _v0.pop_back(); goto reuse; }
         if (!_vc.empty()) { id = _vc.pop_back(); goto reuse; }
         if (_o < N) goto newco;
@@ -191,6 +262,7 @@ class CoroutinePool {
 
     void push(Coroutine* co) {
         const int id = co->id;
+        atomic_store(&_size, _size - 1, mo_relaxed);
         const int q = id >> E;
         if (q == 0) {
             if (_v0.capacity() == 0) _v0.reserve(N);
@@ -221,6 +293,9 @@ class CoroutinePool {
         }
     }
 
+    // number of coroutines in use, it can be read from any thread
+    size_t size() const { return atomic_load(&_size, mo_relaxed); }
+
     Coroutine& operator[](int i) const {
         const int q = i >> E;
         const int r = i & (N - 1);
@@ -230,6 +305,7 @@ class CoroutinePool {
   private:
     int _c; // current block
     int _o; // offset in the current block [0, S)
+    size_t _size; // number of coroutines in use
     co::vector<Coroutine*> _v;
     co::vector<int> _use_count;
     co::vector<int> _v0; // id of coroutine in _v[0]
@@ -237,64 +313,302 @@ class CoroutinePool {
     co::set<int> _blks; // blocks available
 };
 
-// Task may be added from any thread. We need a mutex here.
+// Node of the task queue. It is the same for all task types, so nodes freed 
+// by one queue can be reused by others.
+struct tq_node {
+    tq_node* next;
+    void* task;
+};
+
+// Nodes recycled by consumers are cached in the producer thread, to avoid a 
+// co::alloc() for each push and a cross-thread co::free() for each pop.
+extern __thread tq_node* g_tq_cache;
+
+// put the nodes taken from the spare list of a queue to the cache
+void tq_cache(tq_node* h);
+
+// Lock-free queue with multiple producers and a single consumer.
+//   - Producers push nodes to the front of a singly linked list with CAS.
+//   - The consumer takes all the nodes at once by swapping the head with NULL, 
+//     and then reverses them to the order they were pushed in.
+//   - The consumer gives up to R nodes back to producers through the spare 
+//     list. A producer takes the whole list with a swap, so there is no ABA 
+//     problem, and keeps nodes in its thread cache. The cache holds at most R 
+//     nodes, as it is refilled only when it is empty.
+template<typename T>
+class alignas(co::cache_line_size) TaskQueue {
+  public:
+    typedef tq_node node;
+    static const uint32 R = 256;
+
+    TaskQueue() : _head(0), _spare(0) {}
+
+    ~TaskQueue() {
+        _free(_head);
+        _free(_spare);
+    }
+
+    bool empty() const { return atomic_load(&_head) == 0; }
+
+    // push a task to the queue (thread-safe)
+    void push(T* task) {
+        node* const x = _alloc();
+        x->task = task;
+        node* h = atomic_load(&_head, mo_relaxed);
+        for (;;) {
+            x->next = h;
+            node* const o = atomic_cas(&_head, h, x, mo_seq_cst, mo_relaxed);
+            if (o == h) return;
+            h = o;
+        }
+    }
+
+    // push @n tasks to the queue with a single CAS (thread-safe)
+    void push(T* const* tasks, size_t n) {
+        if (n == 0) return;
+        node* const last = _alloc();
+        last->task = tasks[0];
+        node* first = last;
+        for (size_t i = 1; i < n; ++i) {
+            node* const x = _alloc();
+            x->task = tasks[i];
+            x->next = first;
+            first = x;
+        }
+
+        node* h = atomic_load(&_head, mo_relaxed);
+        for (;;) {
+            last->next = h;
+            node* const o = atomic_cas(&_head, h, first, mo_seq_cst, mo_relaxed);
+            if (o == h) return;
+            h = o;
+        }
+    }
+
+    // pop all tasks to @v, only the consumer can call it
+    void pop_all(co::vector<T*>& v) {
+        node* h = atomic_swap(&_head, (node*)0, mo_acquire);
+        if (h) {
+            node* r = 0;
+            do {
+                node* const x = h;
+                h = h->next;
+                x->next = r;
+                r = x;
+            } while (h);
+
+            // keep the first R nodes in [s, t], free the rest
+            node* const s = r;
+            node* t = r;
+            uint32 n = 0;
+            do {
+                node* const x = r;
+                r = r->next;
+                v.push_back((T*)x->task);
+                if (n < R) {
+                    t = x;
+                    ++n;
+                } else {
+                    co::free(x, sizeof(node));
+                }
+            } while (r);
+            t->next = 0;
+
+            // give them back if the spare list was taken by producers
+            if (atomic_load(&_spare, mo_relaxed) == 0 &&
+                atomic_cas(&_spare, (node*)0, s, mo_release, mo_relaxed) == 0) {
+                return;
+            }
+            _free(s);
+        }
+    }
+
+  private:
+    node* _alloc() {
+        node* x = g_tq_cache;
+        if (x) {
+            g_tq_cache = x->next;
+            return x;
+        }
+        x = atomic_load(&_spare, mo_relaxed) ? atomic_swap(&_spare, (node*)0, mo_acquire) : 0;
+        if (x) {
+            if (x->next) tq_cache(x->next);
+            return x;
+        }
+        x = (node*) co::alloc(sizeof(node)); assert(x);
+        return x;
+    }
+
+    static void _free(node* h) {
+        while (h) {
+            node* const x = h;
+            h = h->next;
+            co::free(x, sizeof(node));
+        }
+    }
+
+    node* _head;
+    node* _spare; // nodes given back by the consumer
+};
+
+// Task may be added from any thread. Lock-free queues are used here.
+//   - Closures added by co::go() are loose tasks if work stealing is enabled, 
+//     an idle scheduler may steal them before they start. We need a mutex for 
+//     the loose tasks, but it is only shared by the owner and the thieves.
+//   - High priority tasks are put into the high priority lane, so are the 
+//     coroutines started by them when they are ready to resume again. They 
+//     are never stolen.
 class alignas(co::cache_line_size) TaskManager {
   public:
-    TaskManager() : _mtx(), _new_tasks(512), _ready_tasks(512) {}
+    TaskManager() : _loose_tasks(), _loose_num(0), _mtx() {}
     ~TaskManager() = default;
 
-    void add_new_task(Closure* cb) {
-        std::lock_guard<std::mutex> g(_mtx);
-        _new_tasks.push_back(cb);
+    void add_new_task(Closure* cb) { is_high(cb) ? _high_new_q.push(cb) : _new_q.push(cb); }
+    void add_loose_task(Closure* cb) { _loose_q.push(cb); }
+    void add_new_tasks(Closure* const* cbs, size_t n) { _new_q.push(cbs, n); }
+    void add_loose_tasks(Closure* const* cbs, size_t n) { _loose_q.push(cbs, n); }
+    void add_ready_task(Coroutine* co) { co->high ? _high_ready_q.push(co) : _ready_q.push(co); }
+
+    // check whether there are tasks not taken by the scheduler yet
+    bool empty() const {
+        return _new_q.empty() && _ready_q.empty() && _loose_q.empty() && this->high_empty();
     }
 
-    void add_ready_task(Coroutine* co) {
-        std::lock_guard<std::mutex> g(_mtx);
-        _ready_tasks.push_back(co);
+    // check whether the high priority lane is empty
+    bool high_empty() const {
+        return _high_new_q.empty() && _high_ready_q.empty();
+    }
+
+    // get all tasks in the high priority lane
+    void get_high_tasks(co::vector<Closure*>& new_tasks, co::vector<Coroutine*>& ready_tasks) {
+        _high_new_q.pop_all(new_tasks);
+        _high_ready_q.pop_all(ready_tasks);
     }
 
-    void get_all_tasks(
+    // Get all the new tasks and ready tasks. Only the front half of the loose 
+    // tasks will be taken, the rest are left for other schedulers to steal.
+    // Return number of loose tasks left.
+    size_t get_all_tasks(
         co::vector<Closure*>& new_tasks,
         co::vector<Coroutine*>& ready_tasks
     ) {
+        _new_q.pop_all(new_tasks);
+        _ready_q.pop_all(ready_tasks);
+        if (_loose_q.empty() && atomic_load(&_loose_num, mo_relaxed) == 0) return 0;
+
+        std::lock_guard<std::mutex> g(_mtx);
+        _loose_q.pop_all(_loose_tasks);
+        const size_t s = _loose_tasks.size();
+        if (s > 0) {
+            const size_t n = s > 1 ? (s >> 1) : 1;
+            Closure** const p = _loose_tasks.data();
+            new_tasks.append(p, n);
+            if (n < s) memmove(p, p + n, (s - n) * sizeof(Closure*));
+            _loose_tasks.resize(s - n);
+            atomic_store(&_loose_num, s - n, mo_relaxed);
+            return s - n;
+        }
+        return 0;
+    }
+
+    // steal the back half of the loose tasks, return number of tasks stolen
+    size_t steal_tasks(co::vector<Closure*>& new_tasks) {
+        if (atomic_load(&_loose_num, mo_relaxed) == 0) return 0;
         std::lock_guard<std::mutex> g(_mtx);
-        if (!_new_tasks.empty()) _new_tasks.swap(new_tasks);
-        if (!_ready_tasks.empty()) _ready_tasks.swap(ready_tasks);
+        const size_t s = _loose_tasks.size();
+        if (s > 0) {
+            const size_t n = (s + 1) >> 1;
+            new_tasks.append(_loose_tasks.data() + (s - n), n);
+            _loose_tasks.resize(s - n);
+            atomic_store(&_loose_num, s - n, mo_relaxed);
+        }
+        return (s + 1) >> 1;
     }
- 
+
   private:
+    TaskQueue<Closure> _new_q;
+    TaskQueue<Coroutine> _ready_q;
+    TaskQueue<Closure> _loose_q;
+    TaskQueue<Closure> _high_new_q;
+    TaskQueue<Coroutine> _high_ready_q;
+    co::vector<Closure*> _loose_tasks; // tasks can be stolen
+    size_t _loose_num;
     std::mutex _mtx;
-    co::vector<Closure*> _new_tasks;
-    co::vector<Coroutine*> _ready_tasks;
 };
 
-inline fastream& operator<<(fastream& fs, const timer_id_t& id) {
-    return fs << *(void**)(&id);
-}
-
-// Timer must be added in the scheduler thread. We need no lock here.
+// Hierarchical timing wheel, timers must be added in the scheduler thread. 
+// We need no lock here.
+//   - There are 256 slots of 1 ms at level 0, and 64 slots at each of the 
+//     other 4 levels, it covers timeouts up to 2^32 ms.
+//   - add_timer() and del_timer() are O(1). Timers in higher levels will be 
+//     moved to lower levels when the wheel turns.
 class TimerManager {
   public:
-    TimerManager() : _timer(), _it(_timer.end()) {}
-    ~TimerManager() = default;
+    static const uint32 B0 = 8;                // bits of level 0
+    static const uint32 B = 6;                 // bits of the other levels
+    static const uint32 L = 5;                 // number of levels
+    static const uint32 N0 = 1u << B0;         // slots of level 0
+    static const uint32 N = 1u << B;           // slots of the other levels
+    static const uint32 S = N0 + (L - 1) * N;  // number of slots
+
+    TimerManager() : _slots(0), _ms(now::ms()), _size(0) {
+        memset(_bits, 0, sizeof(_bits));
+    }
+
+    ~TimerManager() {
+        if (_slots) co::free(_slots, S * sizeof(co::clist));
+    }
+
+    // allocate the slots, it is called in the scheduler thread before any 
+    // timer is added, after the thread is bound to a cpu.
+    void init() {
+        if (!_slots) _slots = (co::clist*) co::zalloc(S * sizeof(co::clist));
+    }
 
     timer_id_t add_timer(uint32 ms, Coroutine* co) {
-        return _it = _timer.emplace_hint(_it, now::ms() + ms, co);
+        const int64 now_ms = now::ms();
+        if (_size++ == 0) _ms = now_ms;
+        TimerNode* const t = &co->timer;
+        t->ms = now_ms + ms;
+        t->co = co;
+        this->_insert(t);
+        return t;
     }
 
-    void del_timer(const timer_id_t& it) {
-        if (_it == it) ++_it;
-        _timer.erase(it);
+    void del_timer(timer_id_t t) {
+        this->_erase(t);
+        --_size;
     }
 
-    timer_id_t end() { return _timer.end(); }
+    timer_id_t end() const { return 0; }
+
+    size_t size() const { return _size; }
 
     // get timedout coroutines, return time(ms) to wait for the next timeout
     uint32 check_timeout(co::vector<Coroutine*>& res);
 
   private:
-    co::multimap<int64, Coroutine*> _timer;        // timed-wait tasks: <time_ms, co>
-    co::multimap<int64, Coroutine*>::iterator _it; // make insert faster with this hint
+    void _insert(TimerNode* t);
+
+    void _erase(TimerNode* t) {
+        _slots[t->slot].erase(t);
+        if (t->slot < N0 && _slots[t->slot].empty()) this->_unset(t->slot);
+    }
+
+    // move timers in the current slot of higher levels to lower levels
+    void _cascade();
+
+    // find the first non-empty slot at level 0 from position @i, or N0 if not found
+    uint32 _next_slot(uint32 i) const;
+
+    void _set(uint32 i)   { _bits[i >> 5] |= (1u << (i & 31)); }
+    void _unset(uint32 i) { _bits[i >> 5] &= ~(1u << (i & 31)); }
+
+  private:
+    co::clist* _slots;     // S slots
+    uint32 _bits[N0 >> 5]; // bitmap of non-empty slots at level 0
+    int64 _ms;             // the next time(ms) to be processed
+    size_t _size;          // number of timers
 };
 
 // coroutine scheduler, loop in a single thread
@@ -320,30 +634,82 @@ class Sched {
         return (s->p <= (char*)p) && ((char*)p < s->top);
     }
 
+    // check if the memory @p points to is on a shared stack, which will be 
+    // copied out when the coroutine is suspended. Memory on a dedicated stack 
+    // stays where it is, and it is safe for others to access it.
+    bool on_shared_stack(const void* p) const {
+        return !_running->stack->dedicated && this->on_stack(p);
+    }
+
+    // whether new coroutines in this scheduler run on dedicated stacks
+    void set_dedicated_stack(bool on) {
+        atomic_store(&_dedicated, on, mo_relaxed);
+    }
+
     // resume a coroutine
     void resume(Coroutine* co);
 
-    // suspend the current coroutine
+    // check if the current coroutine has run for more than @us microseconds 
+    // since it was resumed, always false if the time is not recorded
+    bool slice_used_up(int64 us) const {
+        return _slice.timed && now::us() - _slice.beg >= us;
+    }
+
+    // If a coroutine is running, get the time(us) it was resumed and its id, 
+    // and return true. It can be called in other threads, the result may be 
+    // stale if the coroutine yields at the same time.
+    bool running_since(int64& beg, int& co) const {
+        beg = atomic_load(&_slice.beg, mo_acquire);
+        if (beg == 0) return false;
+        co = atomic_load(&_slice.co, mo_relaxed);
+        return atomic_load(&_slice.beg, mo_acquire) == beg;
+    }
+
+    // id of the scheduler thread, 0 if it has not started yet
+    uint32 thread_id() const { return atomic_load(&_slice.tid, mo_relaxed); }
+
+    // Suspend the current coroutine. The main context may change, as resume() 
+    // can be called at different depth of the scheduler's stack, update it when
+    // the coroutine is resumed again.
     void yield() {
-        tb_context_jump(_main_co->ctx, _running);
+        _main_co->ctx = tb_context_jump(_main_co->ctx, _running).ctx;
     }
 
     // add a new task to run as a coroutine later (thread-safe)
     void add_new_task(Closure* cb) {
         _task_mgr.add_new_task(cb);
-        _x.epoll->signal();
+        this->wake_up();
+    }
+
+    // add a new task that may be stolen by other schedulers (thread-safe)
+    void add_loose_task(Closure* cb) {
+        _task_mgr.add_loose_task(cb);
+        this->wake_up();
+    }
+
+    // add @n new tasks at once, the scheduler is woken up only once (thread-safe)
+    void add_new_tasks(Closure* const* cbs, size_t n, bool loose) {
+        loose ? _task_mgr.add_loose_tasks(cbs, n) : _task_mgr.add_new_tasks(cbs, n);
+        this->wake_up();
     }
 
     // add a coroutine ready to resume (thread-safe)
     void add_ready_task(Coroutine* co) {
         _task_mgr.add_ready_task(co);
-        _x.epoll->signal();
+        this->wake_up();
+    }
+
+    // Wake up the scheduler if it is waiting in epoll. The scheduler will check 
+    // the task queues after it marks itself idle, no signal is needed if it is 
+    // not idle.
+    void wake_up() {
+        if (atomic_load(&_x.idle)) _x.epoll->signal();
     }
 
     // sleep for milliseconds in the current coroutine 
     void sleep(uint32 ms) {
         if (_wait_ms > ms) _wait_ms = ms;
-        (void) _timer_mgr.add_timer(ms, _running);
+        _running->it = _timer_mgr.add_timer(ms, _running);
         this->yield();
     }
 
@@ -358,14 +724,16 @@ class Sched {
     bool timeout() const { return _timeout; }
 
     // add an IO event on a socket to epoll for the current coroutine.
-    bool add_io_event(sock_t fd, _ev_t ev) {
+    //   - @rearm: re-arm the socket if it is already in epoll on linux, see Epoll.
+    bool add_io_event(sock_t fd, _ev_t ev, bool rearm=false) {
         SCHEDLOG << "co(" << _running << ") add io event fd: " << fd << " ev: " << (int)ev;
       #if defined(_WIN32)
-        (void) ev; // we do not care what the event is on windows
+        (void) ev; (void) rearm; // we do not care what the event is on windows
         return _x.epoll->add_event(fd);
       #elif defined(__linux__)
-        return ev == ev_read ? _x.epoll->add_ev_read(fd, _running->id) : _x.epoll->add_ev_write(fd, _running->id);
+        return ev == ev_read ? _x.epoll->add_ev_read(fd, _running->id, rearm) : _x.epoll->add_ev_write(fd, _running->id, rearm);
       #else
+        (void) rearm;
         return ev == ev_read ? _x.epoll->add_ev_read(fd, _running) : _x.epoll->add_ev_write(fd, _running);
       #endif
     }
@@ -382,11 +750,43 @@ class Sched {
         _x.epoll->del_event(fd);
     }
 
+  #ifdef CO_IO_URING
+    // io_uring of this scheduler, NULL if io_uring is not used
+    Uring* uring() const { return _x.uring; }
+
+    // Submit the operation @sqe for the current coroutine, and wait for it to 
+    // complete or time out. 
+    //   - Buffers used by the operation MUST not be on a shared stack.
+    //   - Return result of the operation (-errno on error), or -ETIMEDOUT.
+    int uring_wait(io_uring_sqe* sqe, uint32 ms);
+  #endif
+
     // cputime of this scheduler (us)
     int64 cputime() {
         return atomic_load(&_cputime, mo_relaxed);
     }
 
+    // times this scheduler has stolen tasks from others
+    uint64 steals() const { return atomic_load(&_steal.n, mo_relaxed); }
+
+    // number of tasks this scheduler has stolen from others
+    uint64 stolen_tasks() const { return atomic_load(&_steal.tasks, mo_relaxed); }
+
+    // times the stack data was copied when switching coroutines (save or restore)
+    uint64 stack_copies() const { return atomic_load(&_stats.copies, mo_relaxed); }
+
+    // bytes of the stack data saved when switching coroutines
+    uint64 stack_bytes() const { return atomic_load(&_stats.saved, mo_relaxed); }
+
+    // get a snapshot of the runtime statistics, it can be called from any thread
+    void stats(co::SchedStats& s) const;
+
+    // set all the schedulers, used for work stealing
+    void set_scheds(const co::vector<Sched*>* v) { _scheds = v; }
+
+    // bind the scheduler thread to a cpu when it starts, -1 for not binding
+    void set_cpu(int cpu) { _cpu = cpu; }
+
     // start the scheduler thread
     void start() { std::thread(&Sched::loop, this).detach(); }
 
@@ -400,29 +800,93 @@ class Sched {
     // entry function for coroutine
     static void main_func(tb_context_from_t from);
 
+    // steal loose tasks from other schedulers, return number of tasks stolen
+    size_t steal(co::vector<Closure*>& new_tasks);
+
+    // wake up an idle scheduler to steal tasks from this scheduler
+    void wake_idle_sched();
+
+    // wait for IO events (or completions in io_uring) for at most @ms milliseconds
+    int poll(uint32 ms) {
+      #ifdef CO_IO_URING
+        return _x.uring ? _x.uring->wait(ms) : _x.epoll->wait(ms);
+      #else
+        return _x.epoll->wait(ms);
+      #endif
+    }
+
+    // Spin on the task queues and poll IO events with no timeout, for at most 
+    // FLG_co_busy_poll us or until the next timer expires. Return number of 
+    // events, or 0 if nothing happened, or -1 on error. 
+    int busy_poll();
+
+    // Resume all tasks in the high priority lane. It is called before tasks in 
+    // the normal lane are resumed, and after every few of them, so that a burst 
+    // of normal tasks will not delay the high priority tasks too much, while the
+    // normal lane still makes progress between two batches of high tasks.
+    void run_high_lane();
+
+    // resume coroutines waiting for the IO events returned by epoll
+    void handle_io_events(int n);
+
+  #ifdef CO_IO_URING
+    // resume coroutines waiting for the completions in io_uring
+    void handle_cqes(int n);
+  #endif
+
+    // Add @n to a counter. Counters are written only by the scheduler thread, 
+    // no atomic read-modify-write is needed.
+    static void _count(uint64& x, uint64 n = 1) {
+        atomic_store(&x, x + n, mo_relaxed);
+    }
+
     // save stack for the coroutine
     void save_stack(Coroutine* co) {
         if (co) {
+            const size_t n = co->stack->top - (char*)co->ctx;
             if (!co->pbuf && !_bufs.empty()) co->pbuf = _bufs.pop_back();
             co->buf.clear();
-            co->buf.append(co->ctx, co->stack->top - (char*)co->ctx);
+            co->buf.append(co->ctx, n);
+            _count(_stats.copies);
+            _count(_stats.saved, n);
         }
     }
 
-    // pop a Coroutine from the pool
+    // Choose a shared stack for a new coroutine. A stack no coroutine is bound 
+    // to is preferred, otherwise choose the one whose owner has been suspended 
+    // for the longest time. A coroutine is bound to the stack until it ends.
+    Stack* choose_stack() {
+        Stack* x = _stack;
+        for (uint32 i = 0; i < _stack_num; ++i) {
+            Stack* const s = &_stack[i];
+            if (s->n == 0) return s;
+            if (s->ts < x->ts) x = s;
+        }
+        return x;
+    }
+
+    // pop a Coroutine from the pool, a tagged task will run on a dedicated stack
     Coroutine* new_coroutine(Closure* cb) {
         Coroutine* co = _co_pool.pop();
-        co->cb = cb;
-        if (!co->sched) {
-            co->sched = this;
-            co->stack = &_stack[co->id & (_stack_num - 1)];
+        co->cb = untag(cb);
+        co->high = is_high(cb);
+        if (!co->sched) co->sched = this;
+        if (is_dedicated(cb) || atomic_load(&_dedicated, mo_relaxed)) {
+            co->stack = _stack_pool.pop(co);
+        } else {
+            co->stack = this->choose_stack();
+            co->stack->n++;
         }
-        new(&co->it) timer_id_t(_timer_mgr.end());
+        co->it = _timer_mgr.end();
         return co;
     }
 
     void recycle(Coroutine* co) {
-        co->it.~timer_id_t();
+        if (co->stack->dedicated) {
+            _stack_pool.push(co->stack);
+        } else {
+            co->stack->n--;
+        }
         if (co->pbuf) {
             if (co->buf.capacity() > 8192 || _bufs.size() >= 128) {
                 co->buf.reset();
@@ -445,10 +909,54 @@ class Sched {
         struct {
             co::sync_event ev;
             Epoll* epoll;
+          #ifdef CO_IO_URING
+            Uring* uring;
+          #endif
             bool stopped;
+            bool idle; // waiting for events in epoll
         }_x;
         char _c1[co::cache_line_size];
     };
+    union {
+        struct {
+            uint64 n;     // times of stealing
+            uint64 tasks; // tasks stolen
+        } _steal;
+        char _c2[co::cache_line_size];
+    };
+    union {
+        struct {
+            uint64 switches; // times of resuming coroutines
+            uint64 copies;   // times of stack copying (save or restore)
+            uint64 saved;    // bytes of stack saved
+            uint64 restored; // bytes of stack restored
+            uint64 timers;   // timers fired
+            uint64 wakeups;  // times woken up from epoll after waiting
+            uint64 signals;  // wakeup signals received (pipe or eventfd)
+            uint64 tasks;    // tasks found at the last check of the task queues
+        } _stats;
+        char _c3[co::cache_line_size];
+    };
+    union {
+        struct {
+            uint64 spin_us;  // time(us) of busy polling
+            uint64 sleep_us; // time(us) of sleeping in epoll
+            uint64 high_tasks;    // tasks found in the high priority lane at the last check
+            uint64 high_switches; // times of resuming coroutines in the high priority lane
+        } _stats2;
+        char _c4[co::cache_line_size];
+    };
+    union {
+        struct {
+            int64 beg;  // time(us) the running coroutine was resumed, 0 if no coroutine is running
+            int co;     // id of the running coroutine
+            uint32 tid; // id of the scheduler thread
+            bool timed; // beg and co are set only if the time slice or the watchdog is on
+        } _slice;
+        char _c5[co::cache_line_size];
+    };
+    co::vector<Closure*> _high_new;     // new tasks in the high priority lane
+    co::vector<Coroutine*> _high_ready; // ready tasks in the high priority lane
     TaskManager _task_mgr;
 
     TimerManager _timer_mgr;
@@ -463,6 +971,11 @@ class Sched {
     uint32 _stack_num;   // number of stacks per scheduler
     uint32 _stack_size;  // size of the stack
     Stack* _stack;       // stack array
+    uint32 _seed;        // seed for choosing a scheduler to steal from
+    int _cpu;            // cpu the scheduler thread is bound to, -1 if not bound
+    bool _dedicated;     // run new coroutines on dedicated stacks
+    StackPool _stack_pool; // dedicated stacks
+    const co::vector<Sched*>* _scheds; // all schedulers
 };
 
 class SchedManager {
@@ -478,9 +991,16 @@ class SchedManager {
 
     void stop();
 
+  private:
+    // Check the schedulers every few milliseconds, and report those blocked by 
+    // a coroutine for more than FLG_co_stall_ms milliseconds.
+    void watchdog();
+
   private:
     std::function<Sched*(const co::vector<Sched*>&)> _next;
     co::vector<Sched*> _scheds;
+    co::sync_event _ev; // to stop the watchdog
+    std::thread _watchdog;
 };
 
 static bool g_is_active;
@@ -29,9 +29,50 @@ void set_cloexec(sock_t fd) {
     __sys_api(fcntl)(fd, F_SETFD, __sys_api(fcntl)(fd, F_GETFD) | FD_CLOEXEC);
 }
 
+#ifdef CO_IO_URING
+// Return the io_uring of the scheduler if it can be used for the buffer @p.
+// The kernel may access the buffer after the coroutine was suspended, while 
+// the shared stack is used by other coroutines, so @p can not be on a shared 
+// stack.
+inline Uring* _uring(xx::Sched* s, const void* p) {
+    return (s->uring() && !s->on_shared_stack(p)) ? s->uring() : 0;
+}
+
+inline int _uring_res(int r) {
+    if (r >= 0) return r;
+    errno = -r;
+    return -1;
+}
+
+struct _addr_t {
+    socklen_t n;
+    sockaddr_storage a;
+};
+#endif
+
+// set SO_BUSY_POLL for the socket if busy polling is enabled
+inline sock_t _busy_poll(sock_t fd) {
+  #ifdef SO_BUSY_POLL
+    if (FLG_co_busy_poll > 0 && fd != (sock_t)-1) {
+        int us = (int)FLG_co_busy_poll;
+        // it may fail without CAP_NET_ADMIN if @us is greater than net.core.busy_read
+        const int r = __sys_api(setsockopt)(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us));
+        DLOG_IF(r != 0) << "set SO_BUSY_POLL failed: " << co::strerror() << ", fd: " << fd;
+    }
+  #endif
+    return fd;
+}
+
+// A new socket may take the number of an fd closed without co::close(), clear 
+// the epoll state left by the old one.
+inline sock_t _new_sock(sock_t fd) {
+    if (fd != (sock_t)-1) co::get_sock_ctx(fd).del_event();
+    return _busy_poll(fd);
+}
+
 #ifdef SOCK_NONBLOCK
 sock_t socket(int domain, int type, int protocol) {
-    return __sys_api(socket)(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    return _new_sock(__sys_api(socket)(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol));
 }
 
 #else
@@ -41,7 +82,7 @@ sock_t socket(int domain, int type, int protocol) {
         co::set_nonblock(fd);
         co::set_cloexec(fd);
     }
-    return fd;
+    return _new_sock(fd);
 }
 #endif
 
@@ -107,17 +148,36 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
     const auto sched = xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
 
+  #ifdef CO_IO_URING
+    if (sched->uring()) {
+        // addr is usually on the stack, accept to a buffer on heap instead
+        _addr_t* x = (_addr_t*) co::alloc(sizeof(_addr_t));
+        x->n = sizeof(x->a);
+        auto sqe = sched->uring()->get_sqe();
+        prep_sqe(sqe, IORING_OP_ACCEPT, fd, &x->a, 0, (uint64)(size_t)&x->n);
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        const int r = sched->uring_wait(sqe, (uint32)-1);
+        if (r >= 0 && addr && addrlen) {
+            const int n = (int)x->n;
+            memcpy(addr, &x->a, n < *addrlen ? n : *addrlen);
+            *addrlen = n;
+        }
+        co::free(x, sizeof(_addr_t));
+        if (r != -EAGAIN) return r >= 0 ? _new_sock(r) : _uring_res(r);
+    }
+  #endif
+
     io_event ev(fd, ev_read);
     do {
       #ifdef SOCK_NONBLOCK
         sock_t connfd = __sys_api(accept4)(fd, (sockaddr*)addr, (socklen_t*)addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
-        if (connfd != -1) return connfd;
+        if (connfd != -1) return _new_sock(connfd);
       #else
         sock_t connfd = __sys_api(accept)(fd, (sockaddr*)addr, (socklen_t*)addrlen);
         if (connfd != -1) {
             co::set_nonblock(connfd);
             co::set_cloexec(connfd);
-            return connfd;
+            return _new_sock(connfd);
         }
       #endif
 
@@ -129,25 +189,43 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
     } while (true);
 }
 
+// wait for a non-blocking connect to complete
+static int _wait_connect(sock_t fd, int ms) {
+    io_event ev(fd, ev_write);
+    if (!ev.wait(ms)) return -1;
+
+    int err, len = sizeof(err);
+    const int r = co::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (r != 0) return -1;
+    if (err == 0) return 0;
+    errno = err;
+    return -1;
+}
+
 int connect(sock_t fd, const void* addr, int addrlen, int ms) {
     const auto sched = xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
 
+  #ifdef CO_IO_URING
+    if (sched->uring() && addrlen <= (int)sizeof(sockaddr_storage)) {
+        _addr_t* x = (_addr_t*) co::alloc(sizeof(_addr_t));
+        memcpy(&x->a, addr, addrlen);
+        auto sqe = sched->uring()->get_sqe();
+        prep_sqe(sqe, IORING_OP_CONNECT, fd, &x->a, 0, (uint64)addrlen);
+        const int r = sched->uring_wait(sqe, ms);
+        co::free(x, sizeof(_addr_t));
+        // old kernels may not wait for the connection on non-blocking sockets
+        if (r == -EINPROGRESS || r == -EALREADY) return _wait_connect(fd, ms);
+        if (r != -EAGAIN) return _uring_res(r);
+    }
+  #endif
+
     do {
         int r = __sys_api(connect)(fd, (const sockaddr*)addr, (socklen_t)addrlen);
         if (r == 0) return 0;
 
         if (errno == EINPROGRESS) {
-            io_event ev(fd, ev_write);
-            if (!ev.wait(ms)) return -1;
-
-            int err, len = sizeof(err);
-            r = co::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
-            if (r != 0) return -1;
-            if (err == 0) return 0;
-            errno = err;
-            return -1;
-
+            return _wait_connect(fd, ms);
         } else if (errno != EINTR) {
             return -1;
         }
@@ -158,6 +236,15 @@ int recv(sock_t fd, void* buf, int n, int ms) {
     const auto sched = xx::gSched;
     CHECK(sched) << "must be called in coroutine..";
 
+  #ifdef CO_IO_URING
+    if (auto u = _uring(sched, buf)) {
+        auto sqe = u->get_sqe();
+        prep_sqe(sqe, IORING_OP_RECV, fd, buf, (uint32)n, 0);
+        const int r = sched->uring_wait(sqe, ms);
+        if (r != -EAGAIN) return _uring_res(r);
+    }
+  #endif
+
     io_event ev(fd, ev_read);
     do {
         int r = (int) __sys_api(recv)(fd, buf, n, 0);
@@ -174,6 +261,26 @@ int recv(sock_t fd, void* buf, int n, int ms) {
 int recvn(sock_t fd, void* buf, int n, int ms) {
     char* p = (char*) buf;
     int remain = n;
+
+  #ifdef CO_IO_URING
+    const auto sched = xx::gSched;
+    if (auto u = _uring(sched, buf)) {
+        do {
+            auto sqe = u->get_sqe();
+            prep_sqe(sqe, IORING_OP_RECV, fd, p, (uint32)remain, 0);
+            const int r = sched->uring_wait(sqe, ms);
+            if (r == remain) return n;
+            if (r == 0) return 0;
+            if (r < 0) {
+                if (r == -EAGAIN) break;
+                return _uring_res(r);
+            }
+            remain -= r;
+            p += r;
+        } while (true);
+    }
+  #endif
+
     io_event ev(fd, ev_read);
     do {
         int r = (int) __sys_api(recv)(fd, p, remain, 0);
@@ -216,6 +323,24 @@ int send(sock_t fd, const void* buf, int n, int ms) {
 
     const char* p = (const char*) buf;
     int remain = n;
+
+  #ifdef CO_IO_URING
+    if (auto u = _uring(sched, buf)) {
+        do {
+            auto sqe = u->get_sqe();
+            prep_sqe(sqe, IORING_OP_SEND, fd, p, (uint32)remain, 0);
+            const int r = sched->uring_wait(sqe, ms);
+            if (r == remain) return n;
+            if (r < 0) {
+                if (r == -EAGAIN) break;
+                return _uring_res(r);
+            }
+            remain -= r;
+            p += r;
+        } while (true);
+    }
+  #endif
+
     io_event ev(fd, ev_write);
 
     do {
@@ -54,10 +54,28 @@ class SockCtx {
         _wev.c = co_id;
     }
 
-    void del_event() { _r64 = 0; _w64 = 0; }
+    void del_event() { _r64 = 0; _w64 = 0; atomic_store(&_ep, (uint64)0, mo_relaxed); }
     void del_ev_read()  { _r64 = 0; }
     void del_ev_write() { _w64 = 0; }
 
+    // The socket is registered to epoll of a scheduler on the first wait in that 
+    // scheduler, and it stays there until del_event() is called (on close or 
+    // shutdown). Schedulers are tracked with a bit each, those with id >= 64 
+    // are never marked, and they try EPOLL_CTL_ADD on each wait.
+    //   - If an fd is closed without del_event(), the bits are stale. They are 
+    //     cleared when its number is reused by the hooked socket(), accept(), 
+    //     dup()... or co::socket(), co::accept(). co::add_io_event() re-adds 
+    //     the socket when EPOLL_CTL_MOD fails with ENOENT.
+    //   - Return true if the socket is registered to epoll of the scheduler.
+    bool is_registered(int sched_id) const {
+        return sched_id < 64 && (atomic_load(&_ep, mo_relaxed) & ((uint64)1 << sched_id));
+    }
+
+    // mark the socket as registered to epoll of the scheduler
+    void set_registered(int sched_id) {
+        if (sched_id < 64) atomic_or(&_ep, (uint64)1 << sched_id, mo_relaxed);
+    }
+
     bool has_ev_read()  const { return _rev.c != 0; }
     bool has_ev_write() const { return _wev.c != 0; }
 
@@ -88,6 +106,7 @@ class SockCtx {
     };
     union { S _rev; uint64 _r64; };
     union { S _wev; uint64 _w64; };
+    uint64 _ep; // bit i is set if the socket was registered to epoll of scheduler i
 };
 
 #else
@@ -11,11 +11,19 @@
 #include "StackWalker.hpp"
 #else
 #include <unistd.h>
+#include <signal.h>
 #include <sys/select.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #ifdef HAS_BACKTRACE_H
 #include <backtrace.h>
 #include <cxxabi.h>
 #endif
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+#include <execinfo.h>
+#define HAS_EXECINFO_H
+#endif
 #endif
 #include <time.h>
 
@@ -40,6 +48,7 @@ DEF_uint32(log_flush_ms, 128, ">>#0 flush the log buffer every n ms");
 DEF_bool(cout, false, ">>#0 also logging to terminal");
 DEF_bool(log_daily, false, ">>#0 if true, enable daily log rotation");
 DEF_bool(log_compress, false, ">>#0 if true, compress rotated log files with xz");
+DEF_int32(log_trace_signal, 0, ">>#0 signal used by log::stack_trace() to interrupt a thread on unix, 0: SIGRTMAX-1 on linux or SIGUSR2 elsewhere, it is not used if the application has a handler for it");
 
 // When this value is true, the above flags should have been initialized, 
 // and we are safe to start the logging thread.
@@ -723,7 +732,8 @@ class StackTrace : public StackWalker {
         StackWalker::RetrieveLine |
         StackWalker::RetrieveModuleInfo;
 
-    StackTrace() : StackWalker(kOptions), _f(0), _skip(0) {}
+    explicit StackTrace(bool to_stderr = true)
+        : StackWalker(kOptions), _f(0), _skip(0), _stderr(to_stderr) {}
 
     virtual ~StackTrace() = default;
 
@@ -733,12 +743,19 @@ class StackTrace : public StackWalker {
         this->ShowCallstack(GetCurrentThread());
     }
 
+    // dump stack of another thread, it is suspended while walking the stack
+    void dump_stack(void* f, HANDLE thread) {
+        _f = (write_cb_t) f;
+        _skip = 0;
+        this->ShowCallstack(thread);
+    }
+
   private:
     virtual void OnOutput(LPCSTR s) {
         if (_skip > 0) { --_skip; return; }
         const size_t n = strlen(s);
         if (_f) _f(s, n);
-        auto r = ::fwrite(s, 1, n, stderr); (void)r;
+        if (_stderr) { auto r = ::fwrite(s, 1, n, stderr); (void)r; }
     }
 
     virtual void OnSymInit(LPCSTR, DWORD, LPCSTR) {}
@@ -748,6 +765,7 @@ class StackTrace : public StackWalker {
   private:
     write_cb_t _f;
     int _skip;
+    bool _stderr;
 };
 
 #else 
@@ -755,8 +773,9 @@ class StackTrace : public StackWalker {
 class StackTrace{
   public:
     typedef void (*write_cb_t)(const char*, size_t);
-    StackTrace()
-        : _f(0), _buf((char*)::malloc(4096)), _size(4096), _s(4096), _exe(os::exepath()) {
+    explicit StackTrace(bool to_stderr = true)
+        : _f(0), _buf((char*)::malloc(4096)), _size(4096), _s(4096), _exe(os::exepath()),
+          _stderr(to_stderr) {
         memset(_buf, 0, 4096);
         memset((char*)_s.data(), 0, _s.capacity());
         (void) _exe.c_str();
@@ -776,6 +795,7 @@ class StackTrace{
     size_t _size;  // buf size
     fastream _s;   // for stack trace
     fastring _exe; // exe path
+    bool _stderr;  // also write to stderr
 };
 
 #ifdef HAS_BACKTRACE_H
@@ -825,7 +845,7 @@ int StackTrace::backtrace(const char* file, int line, const char* func, int& cou
        << (file ? file : "???") << ':' << line << '\n';
 
     if (_f) _f(_s.data(), _s.size());
-    log2stderr(_s.data(), _s.size());
+    if (_stderr) log2stderr(_s.data(), _s.size());
     return 0;
 }
 
@@ -836,6 +856,160 @@ void StackTrace::dump_stack(void*, int) {}
 
 #endif // _WIN32
 
+#ifdef _WIN32
+// Stack trace of another thread, the thread is suspended by StackWalker.
+class ThreadStackTrace {
+  public:
+    ThreadStackTrace() : _st(co::_make_static<StackTrace>(false)), _s(8192) {}
+    ~ThreadStackTrace() = default;
+
+    bool get(uint32 tid, fastream& s);
+    static void write(const char* p, size_t n);
+
+  private:
+    std::mutex _m;
+    StackTrace* _st;
+    fastream _s;
+};
+
+static ThreadStackTrace* g_tst;
+
+void ThreadStackTrace::write(const char* p, size_t n) {
+    g_tst->_s.append(p, n);
+}
+
+bool ThreadStackTrace::get(uint32 tid, fastream& s) {
+    const DWORD access = THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION;
+    HANDLE h = ::OpenThread(access, FALSE, tid);
+    if (!h) return false;
+    std::lock_guard<std::mutex> g(_m);
+    _s.clear();
+    _st->dump_stack((void*)&ThreadStackTrace::write, h);
+    ::CloseHandle(h);
+    s.append(_s.data(), _s.size());
+    return !_s.empty();
+}
+
+#else
+// Stack trace of another thread. The thread is interrupted by a signal, and 
+// the handler only saves return addresses to a preallocated buffer, which is 
+// async-signal-safe. The addresses are translated to symbols by the caller.
+class ThreadStackTrace {
+  public:
+    ThreadStackTrace() : _sig(0), _tid(0), _n(0), _state(0) {}
+    ~ThreadStackTrace() = default;
+
+    bool init();
+    bool get(uint32 tid, fastream& s);
+    static void on_signal(int);
+
+  private:
+    enum { N = 64 };
+    std::mutex _m;
+    int _sig;
+    uint32 _tid; // thread being requested
+    int _n;
+    void* _pc[N];
+    int _state;  // 0: idle, 1: waiting for the thread, 2: writing, 3: done
+};
+
+static ThreadStackTrace* g_tst;
+
+inline uint32 _gettid() {
+  #ifdef __linux__
+    return (uint32) ::syscall(SYS_gettid);
+  #else
+    return 0;
+  #endif
+}
+
+void ThreadStackTrace::on_signal(int) {
+    auto& x = *g_tst;
+    // a late signal for a request that has timed out, or for another thread
+    if (atomic_load(&x._tid, mo_relaxed) != _gettid()) return;
+    if (atomic_cas(&x._state, 1, 2, mo_acquire, mo_relaxed) != 1) return;
+  #ifdef HAS_EXECINFO_H
+    const int e = errno;
+    x._n = ::backtrace(x._pc, N);
+    errno = e;
+  #else
+    x._n = 0;
+  #endif
+    atomic_store(&x._state, 3, mo_release);
+}
+
+inline int signal_thread(uint32 tid, int sig) {
+  #ifdef __linux__
+    return (int) ::syscall(SYS_tgkill, ::getpid(), (pid_t)tid, sig);
+  #else
+    (void)tid; (void)sig;
+    return -1; // a thread can not be signaled by its id
+  #endif
+}
+
+// Install the signal handler, unless the application has its own handler.
+bool ThreadStackTrace::init() {
+    int sig = FLG_log_trace_signal;
+    if (sig <= 0) {
+      #ifdef SIGRTMAX
+        sig = SIGRTMAX - 1;
+      #else
+        sig = SIGUSR2;
+      #endif
+    }
+    struct sigaction old;
+    if (::sigaction(sig, NULL, &old) != 0) return false;
+    if ((old.sa_flags & SA_SIGINFO) || (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN)) {
+        return false;
+    }
+  #ifdef HAS_EXECINFO_H
+    // the first call of backtrace() may load libgcc and allocate memory
+    void* pc[2];
+    (void) ::backtrace(pc, 2);
+  #endif
+    if (os::signal(sig, &ThreadStackTrace::on_signal, SA_RESTART) == SIG_ERR) return false;
+    _sig = sig;
+    return true;
+}
+
+bool ThreadStackTrace::get(uint32 tid, fastream& s) {
+    if (_sig == 0) return false;
+    std::lock_guard<std::mutex> g(_m);
+    atomic_store(&_tid, tid, mo_relaxed);
+    atomic_store(&_state, 1, mo_release);
+    if (signal_thread(tid, _sig) != 0) {
+        atomic_store(&_state, 0, mo_relaxed);
+        return false;
+    }
+
+    for (int i = 0; i < 1000 && atomic_load(&_state, mo_acquire) != 3; ++i) {
+        signal_safe_sleep(1);
+    }
+
+    // time out, the handler will ignore the signal if it comes later
+    if (atomic_cas(&_state, 1, 0, mo_acq_rel, mo_acquire) == 1) return false;
+    // the handler is writing the addresses, it will finish soon
+    while (atomic_load(&_state, mo_acquire) != 3) signal_safe_sleep(1);
+    atomic_store(&_state, 0, mo_relaxed);
+
+  #ifdef HAS_EXECINFO_H
+    // skip the frames of the signal handler and the signal trampoline
+    const int k = 2;
+    const int n = _n;
+    char** syms = n > k ? ::backtrace_symbols(_pc, n) : 0;
+    if (syms) {
+        for (int i = k; i < n; ++i) {
+            s << '#' << (i - k) << "  " << syms[i] << '\n';
+        }
+        ::free(syms);
+    }
+    return n > k;
+  #else
+    return false;
+  #endif
+}
+#endif
+
 class ExceptHandler {
   public:
     ExceptHandler();
@@ -1126,6 +1300,20 @@ void set_write_cb(const std::function<void(const char*, const void*, size_t)>& c
     xx::mod().logger->set_write_cb(cb, flags);
 }
 
+static std::once_flag g_tst_flag;
+
+bool stack_trace(uint32 tid, fastream& s) {
+    std::call_once(g_tst_flag, []() {
+        xx::g_tst = co::_make_static<xx::ThreadStackTrace>();
+      #ifndef _WIN32
+        if (!xx::g_tst->init()) {
+            ELOG << "log::stack_trace() is disabled, a handler for the signal is installed";
+        }
+      #endif
+    });
+    return xx::g_tst->get(tid, s);
+}
+
 } // log
 } // _xx
 
@@ -2,7 +2,12 @@
 #include "co/atomic.h"
 #include "co/clist.h"
 #include "co/god.h"
+#include "co/flag.h"
 #include "co/log.h"
+#include "co/json.h"
+#include "co/time.h"
+#include <condition_variable>
+#include <thread>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -15,6 +20,10 @@
 #include <sys/mman.h>
 #endif
 
+DEF_uint32(mem_decay_ms, 10000, ">>#0 free large blocks idle for more than n ms are returned to the OS, 0 to return them at once");
+DEF_uint32(mem_max_retained, 64, ">>#0 max size(MB) of free large blocks retained for reuse, 0 to retain nothing");
+DEF_uint32(mem_huge_page, 0, ">>#0 back large blocks with 2M huge pages on 64-bit linux, 0: off, 1: transparent huge pages (MADV_HUGEPAGE), 2: MAP_HUGETLB, falls back to 1 if no huge page is reserved. It applies to blocks committed after it is set");
+
 
 #ifdef _WIN32
 inline void* _vm_reserve(size_t n) {
@@ -47,6 +56,10 @@ inline uint32 _find_lsb(size_t x) { /* x != 0 */
     return r;
 }
 
+inline uint32 _pop_count(size_t x) {
+    return (uint32)__popcnt64(x);
+}
+
 #else
 inline int _find_msb(size_t x) { /* x != 0 */
     unsigned long i;
@@ -59,6 +72,10 @@ inline uint32 _find_lsb(size_t x) { /* x != 0 */
     _BitScanForward(&r, x);
     return r;
 }
+
+inline uint32 _pop_count(size_t x) {
+    return __popcnt(x);
+}
 #endif
 
 inline uint32 _pow2_align(uint32 n) {
@@ -86,13 +103,22 @@ inline void _vm_commit(void* p, size_t n) {
     assert(x == p); (void)x;
 }
 
-inline void _vm_decommit(void* p, size_t n) {
+inline void _vm_remap(void* p, size_t n) {
     (void) ::mmap(
         p, n, PROT_READ | PROT_WRITE,
         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0
     );
 }
 
+inline void _vm_decommit(void* p, size_t n) {
+  #ifdef __linux__
+    // pages are dropped at once, and zero-filled on the next access
+    (void) ::madvise(p, n, MADV_DONTNEED);
+  #else
+    _vm_remap(p, n);
+  #endif
+}
+
 inline void _vm_free(void* p, size_t n) {
     ::munmap(p, n);
 }
@@ -106,6 +132,10 @@ inline uint32 _find_lsb(size_t x) { /* x != 0 */
     return __builtin_ffsll(x) - 1;
 }
 
+inline uint32 _pop_count(size_t x) {
+    return __builtin_popcountll(x);
+}
+
 #else
 inline int _find_msb(size_t v) { /* x != 0 */
     return 31 - __builtin_clz(v);
@@ -114,6 +144,10 @@ inline int _find_msb(size_t v) { /* x != 0 */
 inline uint32 _find_lsb(size_t x) { /* x != 0 */
     return __builtin_ffs(x) - 1;
 }
+
+inline uint32 _pop_count(size_t x) {
+    return __builtin_popcount(x);
+}
 #endif
 
 inline uint32 _pow2_align(uint32 n) {
@@ -122,6 +156,37 @@ inline uint32 _pow2_align(uint32 n) {
 
 #endif
 
+// commit a large block, and back it with huge pages if FLG_mem_huge_page is set.
+// Large blocks are 2M aligned on arch64, the same as huge pages on linux.
+//   - Return true if the block is backed by MAP_HUGETLB pages.
+inline bool _vm_commit_block(void* p, size_t n) {
+  #if defined(__linux__) && __arch64 && defined(MAP_HUGETLB) && defined(MADV_HUGEPAGE)
+    const uint32 hp = FLG_mem_huge_page;
+    if (hp == 2) {
+        void* x = ::mmap(
+            p, n, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0
+        );
+        if (x == p) return true;
+    }
+    _vm_commit(p, n);
+    if (hp) (void) ::madvise(p, n, MADV_HUGEPAGE);
+  #else
+    _vm_commit(p, n);
+  #endif
+    return false;
+}
+
+// decommit a large block committed by _vm_commit_block(), MADV_DONTNEED may 
+// not work for MAP_HUGETLB pages on old kernels, the block is remapped then.
+inline void _vm_decommit_block(void* p, size_t n, bool hugetlb) {
+  #ifndef _WIN32
+    if (hugetlb) { _vm_remap(p, n); return; }
+  #endif
+    (void) hugetlb;
+    _vm_decommit(p, n);
+}
+
 
 namespace co {
 namespace xx {
@@ -305,7 +370,7 @@ class Bitset {
 class HugeBlock : public co::clink {
   public:
     explicit HugeBlock(void* p) : _p((char*)p) {
-        //assert(!next && !prev && _bits == 0);
+        //assert(!next && !prev && _bits == 0 && _htlb == 0);
     }
 
     void* alloc() {
@@ -318,13 +383,32 @@ class HugeBlock : public co::clink {
     }
 
     bool free(void* p) {
-        const uint32 i = (uint32)(((char*)p - _p) >> g_lb_bits);
-        return (_bits &= ~(C << i)) == 0;
+        return (_bits &= ~(C << this->_index(p))) == 0;
+    }
+
+    // Mark a block backed by MAP_HUGETLB pages. It is set and cleared by the 
+    // thread that commits or releases the block, without the lock.
+    void set_hugetlb(void* p) {
+        atomic_or(&_htlb, C << this->_index(p), mo_relaxed);
+    }
+
+    // clear the mark, return true if the block was marked
+    bool clear_hugetlb(void* p) {
+        const size_t b = C << this->_index(p);
+        if (!(atomic_load(&_htlb, mo_relaxed) & b)) return false;
+        atomic_and(&_htlb, ~b, mo_relaxed);
+        return true;
+    }
+
+  private:
+    uint32 _index(void* p) const {
+        return (uint32)(((char*)p - _p) >> g_lb_bits);
     }
 
   private:
     char* _p; // beginning address to alloc
     size_t _bits;
+    size_t _htlb; // blocks backed by MAP_HUGETLB pages
     DISALLOW_COPY_AND_ASSIGN(HugeBlock);
 };
 
@@ -343,9 +427,9 @@ inline HugeBlock* make_huge_block() {
 // manage and alloc small blocks(32K)
 class LargeBlock : public co::clink {
   public:
+    // the memory may be reused from a free block, do not assume it is zeroed
     explicit LargeBlock(HugeBlock* parent)
-        : _p((char*)this + (1u << g_sb_bits)), _parent(parent) {
-        //assert(!next && !prev && _bits == 0);
+        : _p((char*)this + (1u << g_sb_bits)), _bits(0), _parent(parent) {
     }
 
     void* alloc() {
@@ -371,6 +455,12 @@ class LargeBlock : public co::clink {
     DISALLOW_COPY_AND_ASSIGN(LargeBlock);
 };
 
+// a free large block retained for reuse, it is still committed
+struct FreeBlock : co::clink {
+    HugeBlock* hb;
+    int64 t; // time(ms) the block was freed
+};
+
 // manage huge blocks, and alloc large blocks
 //   - shared by all threads
 class GlobalAlloc;
@@ -378,6 +468,9 @@ class GlobalAlloc;
 // thread-local allocator
 class ThreadAlloc;
 
+// called by the owner thread when @n frees from other threads are reclaimed
+inline void xfree_reclaimed(ThreadAlloc* ta, uint32 n);
+
 // LargeAlloc is a large block, it allocates memory from 4K to 128K(64K) bytes
 class LargeAlloc : public co::clink {
   public:
@@ -385,14 +478,15 @@ class LargeAlloc : public co::clink {
     static const uint32 LA_SIZE = 64;
     static const uint32 MAX_BIT = BS_BITS - 1;
 
+    // the memory may be reused from a free block, clear the bitsets
     explicit LargeAlloc(HugeBlock* parent, ThreadAlloc* ta)
-        : _parent(parent), _ta(ta) {
+        : _bit(0), _parent(parent), _ta(ta) {
         static_assert(sizeof(*this) <= LA_SIZE, "");
         static_assert((BS_BITS >> 3) <= LA_SIZE, "");
         _p = (char*)this + 4096;
         _pbs = (char*)this + LA_SIZE;
         _xpbs = (char*)this + (LA_SIZE + LA_SIZE);
-        //assert(!next && !prev && _bit == 0);
+        memset(_pbs, 0, LA_SIZE + LA_SIZE);
     }
 
     // alloc n units
@@ -455,10 +549,12 @@ void* LargeAlloc::try_hard_alloc(uint32 n) {
     while (p[i] == 0) --i;
     size_t x = atomic_load(&q[i], mo_relaxed);
     if (x) {
+        uint32 xn = 0;
         for (;;) {
             if (x) {
                 atomic_and(&q[i], ~x, mo_relaxed);
                 p[i] &= ~x;
+                xn += _pop_count(x);
                 const int lsb = static_cast<int>(_find_lsb(x) + (i << B));
                 const int r = _bs.rfind(_bit);
                 if (r >= lsb) break;
@@ -468,6 +564,7 @@ void* LargeAlloc::try_hard_alloc(uint32 n) {
             if (--i < 0) break;
             x = atomic_load(&q[i], mo_relaxed);
         }
+        xfree_reclaimed(_ta, xn);
     }
 
     if (_bit + n <= MAX_BIT) {
@@ -492,6 +589,7 @@ class SmallAlloc : public co::clink {
         _p = (char*)this + (SA_SIZE + (BS_BITS >> 2));
         _pbs = (char*)this + SA_SIZE;
         _xpbs = (char*)this + (SA_SIZE + (BS_BITS >> 3));
+        memset(_pbs, 0, BS_BITS >> 2); // the memory may hold stale data
         next = prev = 0;
     }
 
@@ -570,10 +668,12 @@ void* SmallAlloc::try_hard_alloc(uint32 n) {
     while (p[i] == 0) --i;
     size_t x = atomic_load(&q[i], mo_relaxed);
     if (x) {
+        uint32 xn = 0;
         for (;;) {
             if (x) {
                 atomic_and(&q[i], ~x, mo_relaxed);
                 p[i] &= ~x;
+                xn += _pop_count(x);
                 const int lsb = static_cast<int>(_find_lsb(x) + (i << B));
                 const int r = _bs.rfind(_bit);
                 if (r >= lsb) break;
@@ -583,6 +683,7 @@ void* SmallAlloc::try_hard_alloc(uint32 n) {
             if (--i < 0) break;
             x = atomic_load(&q[i], mo_relaxed);
         }
+        xfree_reclaimed(_ta, xn);
     }
 
     if (_bit + n <= MAX_BIT) {
@@ -595,28 +696,72 @@ void* SmallAlloc::try_hard_alloc(uint32 n) {
 
 class GlobalAlloc {
   public:
-    GlobalAlloc() = default;
+    GlobalAlloc()
+        : _orphans(0), _nhb(0), _nlb(0), _nfb(0), _sys_n(0), _sys_b(0),
+          _scav_on(false), _scav_stop(false), _scav_done(false) {}
     ~GlobalAlloc();
 
     struct alignas(co::cache_line_size) X {
-        X() : mtx(), hb(0) {}
+        X() : mtx(), hb(0), lfb() {}
         std::mutex mtx;
         union {
             HugeBlock* hb;
             co::clist lhb;
         };
+        co::clist lfb; // free large blocks, the most recently freed at the front
     };
 
     void* alloc(uint32 alloc_id, HugeBlock** parent);
     LargeBlock* make_large_block(uint32 alloc_id);
     LargeAlloc* make_large_alloc(uint32 alloc_id);
     void free(void* p, HugeBlock* hb, uint32 alloc_id);
+    void scavenge();
+
+    // allocations larger than g_max_alloc_size
+    void* sys_alloc(size_t n, bool zero=false);
+    void* sys_realloc(void* p, size_t o, size_t n);
+    void sys_free(void* p, size_t n);
+
+    void add_talloc(ThreadAlloc* ta);
+    void abandon(ThreadAlloc* ta);
+    ThreadAlloc* adopt();
+    mem_stat stats(const std::function<void(uint32, const mem_stat&)>& f);
+
+  private:
+    void _release(X& x, void* p, HugeBlock* hb);
+    void _expire(X& x, int64 now_ms, co::clist& l);
+    void _release(X& x, co::clist& l);
+    void _start_scavenger();
+    void _scavenger();
 
   private:
     X _x[g_array_size];
+    std::mutex _tm;
+    co::clist _tl; // all thread-local allocators
+    ThreadAlloc* _orphans; // allocators of exited threads
+    size_t _nhb;   // number of huge blocks
+    size_t _nlb;   // number of large blocks committed
+    size_t _nfb;   // number of free large blocks retained
+    size_t _sys_n; // number of allocations by ::malloc
+    size_t _sys_b; // bytes in use allocated by ::malloc
+
+    // the scavenger thread, started when a free block is retained the first time
+    std::mutex _sm;
+    std::condition_variable _scv;
+    bool _scav_on;
+    bool _scav_stop;
+    bool _scav_done;
 };
 
 GlobalAlloc::~GlobalAlloc() {
+    if (atomic_load(&_scav_on, mo_acquire)) {
+        // The thread may have been killed already when the process is exiting 
+        // on windows, do not wait for it too long.
+        std::unique_lock<std::mutex> g(_sm);
+        _scav_stop = true;
+        _scv.notify_one();
+        _scv.wait_for(g, std::chrono::milliseconds(64), [this]() { return _scav_done; });
+    }
     for (uint32 i = 0; i < g_array_size; ++i) {
         std::lock_guard<std::mutex> g(_x[i].mtx);
         HugeBlock *h = _x[i].hb, *next;
@@ -630,11 +775,28 @@ GlobalAlloc::~GlobalAlloc() {
 
 static uint32 g_talloc_id = (uint32)-1;
 
-class alignas(co::cache_line_size) ThreadAlloc {
+// update a counter written only by the owner thread and read by others
+inline void _stat_add(size_t& x, size_t n) {
+    atomic_store(&x, x + n, mo_relaxed);
+}
+
+inline void _stat_sub(size_t& x, size_t n) {
+    atomic_store(&x, x - n, mo_relaxed);
+}
+
+// size of memory used by a small allocation
+inline size_t _small_size(size_t n) {
+    return n > 16 ? god::align_up<16>(n) : 16;
+}
+
+class alignas(co::cache_line_size) ThreadAlloc : public co::clink {
   public:
     ThreadAlloc(GlobalAlloc* ga)
-        : _lb(0), _la(0), _sa(0), _ga(ga), _s(16 * 1024) {
+        : _lb(0), _la(0), _sa(0), _ga(ga), _s(16 * 1024), _onext(0),
+          _nsa(0), _nla(0), _nlb(0), _sbytes(0), _lbytes(0),
+          _xn(0), _xr(0), _xsbytes(0), _xlbytes(0) {
         _id = atomic_inc(&g_talloc_id, mo_relaxed);
+        ga->add_talloc(this);
     }
     ~ThreadAlloc() = default;
 
@@ -646,6 +808,16 @@ class alignas(co::cache_line_size) ThreadAlloc {
     void* try_realloc(void* p, size_t o, size_t n);
     void* salloc(size_t n) { return _s.alloc(n); }
 
+    void stats(mem_stat& s) const;
+    void xstats(size_t* x) const;
+    void xfree_reclaimed(uint32 n) { _stat_add(_xr, n); }
+    ThreadAlloc*& onext() { return _onext; }
+
+  private:
+    LargeBlock* _make_large_block();
+    LargeAlloc* _make_large_alloc();
+    SmallAlloc* _make_small_alloc(LargeBlock* lb);
+
   private:
     union { LargeBlock* _lb; co::clist _llb; };
     union { LargeAlloc* _la; co::clist _lla; };
@@ -653,8 +825,27 @@ class alignas(co::cache_line_size) ThreadAlloc {
     uint32 _id;
     GlobalAlloc* _ga;
     StaticAlloc _s; 
+    ThreadAlloc* _onext; // next in the orphan list of GlobalAlloc
+
+    // stats, written only by this thread
+    size_t _nsa;    // number of small allocs
+    size_t _nla;    // number of large allocs
+    size_t _nlb;    // number of large blocks for small allocs
+    size_t _sbytes; // bytes allocated from small allocs, minus bytes freed by this thread
+    size_t _lbytes; // bytes allocated from large allocs, minus bytes freed by this thread
+
+    // Frees across threads are counted by the thread that frees the memory, 
+    // they are subtracted from the totals of all threads in GlobalAlloc::stats().
+    size_t _xn;      // frees of memory allocated by other threads
+    size_t _xr;      // frees from other threads reclaimed by this thread
+    size_t _xsbytes; // bytes of small allocations freed for other threads
+    size_t _xlbytes; // bytes of large allocations freed for other threads
 };
 
+inline void xfree_reclaimed(ThreadAlloc* ta, uint32 n) {
+    ta->xfree_reclaimed(n);
+}
+
 
 struct alignas(co::cache_line_size) { char _[sizeof(Root)]; } g_root_buf;
 Root& g_root = *(Root*)&g_root_buf;
@@ -673,10 +864,46 @@ Initializer::~Initializer() {
     if (--g_nifty_counter == 0) g_root.~Root();
 }
 
+static __thread bool g_exited;
+
+// Give the allocator back to GlobalAlloc when the thread exits.
+struct TallocGuard {
+    ~TallocGuard() {
+        g_exited = true;
+        if (g_ta) { g_ga->abandon(g_ta); g_ta = 0; }
+    }
+};
+
+// A new thread adopts the allocator of an exited thread if there is one, so 
+// that blocks owned by it are reused, and frees from other threads to it are 
+// reclaimed, instead of being stranded.
+ThreadAlloc* make_talloc() {
+    if (!g_exited) {
+        static thread_local TallocGuard g;
+        (void)g;
+    }
+    auto ta = g_ga->adopt();
+    return ta ? ta : g_root.make<ThreadAlloc>(g_ga);
+}
+
 inline ThreadAlloc* talloc() {
-    return g_ta ? g_ta : (g_ta = g_root.make<ThreadAlloc>(g_ga));
+    return g_ta ? g_ta : (g_ta = make_talloc());
 }
 
+// Used when the thread has no allocator. Destructors of other thread_local 
+// objects may allocate or free after the guard has run, the allocator adopted 
+// for them is abandoned again at the end of the call, or it will be stranded.
+struct Talloc {
+    Talloc() : ta(talloc()) {}
+    ~Talloc() {
+        if (g_exited && g_ta) { g_ga->abandon(g_ta); g_ta = 0; }
+    }
+    ThreadAlloc* const ta;
+};
+
+// the temporary Talloc lives until the end of the full expression
+#define _talloc() (xx::g_ta ? xx::g_ta : xx::Talloc().ta)
+
 #define _try_alloc(l, n, k) \
     const auto h = l.front(); \
     auto k = h->next; \
@@ -689,6 +916,14 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
 
     do {
         std::lock_guard<std::mutex> g(x.mtx);
+        if (!x.lfb.empty()) {
+            // reuse a free block, it is still committed
+            const auto b = (FreeBlock*) x.lfb.pop_front();
+            atomic_dec(&_nfb, mo_relaxed);
+            *parent = b->hb;
+            memset((void*)b, 0, sizeof(*b));
+            return b;
+        }
         if (x.hb && (p = x.hb->alloc())) {
             *parent = x.hb;
             goto end;
@@ -705,6 +940,7 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
         {
             auto hb = make_huge_block();
             if (hb) {
+                atomic_inc(&_nhb, mo_relaxed);
                 x.lhb.push_front(hb);
                 p = hb->alloc();
                 *parent = hb;
@@ -713,20 +949,108 @@ inline void* GlobalAlloc::alloc(uint32 alloc_id, HugeBlock** parent) {
     } while (0);
 
   end:
-    if (p) _vm_commit(p, 1u << g_lb_bits);
+    if (p) {
+        if (_vm_commit_block(p, 1u << g_lb_bits)) (*parent)->set_hugetlb(p);
+        atomic_inc(&_nlb, mo_relaxed);
+    }
     return p;
 }
 
+// Free blocks are retained for reuse, and returned to the OS when they are idle 
+// for more than FLG_mem_decay_ms, or too many of them are retained.
 inline void GlobalAlloc::free(void* p, HugeBlock* hb, uint32 alloc_id) {
-    _vm_decommit(p, 1u << g_lb_bits);
     auto& x = _x[alloc_id & (g_array_size - 1)];
+    if (FLG_mem_decay_ms > 0 && FLG_mem_max_retained > 0) {
+        const int64 now_ms = now::ms();
+        const auto b = (FreeBlock*)p;
+        b->hb = hb;
+        b->t = now_ms;
+        co::clist l;
+        {
+            std::lock_guard<std::mutex> g(x.mtx);
+            x.lfb.push_front(b);
+            atomic_inc(&_nfb, mo_relaxed);
+            this->_expire(x, now_ms, l);
+        }
+        this->_release(x, l);
+        if (!atomic_load(&_scav_on, mo_relaxed)) this->_start_scavenger();
+    } else {
+        this->_release(x, p, hb);
+    }
+}
+
+// move blocks at the back of the free list to @l, which are idle for too long, 
+// or the oldest ones if the free memory retained exceeds the limit. 
+// x.mtx must be locked.
+inline void GlobalAlloc::_expire(X& x, int64 now_ms, co::clist& l) {
+    const int64 decay = FLG_mem_decay_ms;
+    const size_t max_n = ((size_t)FLG_mem_max_retained << 20) >> g_lb_bits;
+    for (;;) {
+        const auto b = (FreeBlock*) x.lfb.back();
+        if (!b) break;
+        if (now_ms - b->t <= decay && atomic_load(&_nfb, mo_relaxed) <= max_n) break;
+        x.lfb.pop_back();
+        atomic_dec(&_nfb, mo_relaxed);
+        l.push_back(b);
+    }
+}
+
+inline void GlobalAlloc::_release(X& x, co::clist& l) {
+    while (!l.empty()) {
+        const auto b = (FreeBlock*) l.pop_front();
+        this->_release(x, b, b->hb);
+    }
+}
+
+void GlobalAlloc::scavenge() {
+    const int64 now_ms = now::ms();
+    for (uint32 i = 0; i < g_array_size; ++i) {
+        auto& x = _x[i];
+        co::clist l;
+        {
+            std::lock_guard<std::mutex> g(x.mtx);
+            this->_expire(x, now_ms, l);
+        }
+        this->_release(x, l);
+    }
+}
+
+void GlobalAlloc::_start_scavenger() {
+    std::lock_guard<std::mutex> g(_sm);
+    if (!_scav_on) {
+        std::thread(&GlobalAlloc::_scavenger, this).detach();
+        atomic_store(&_scav_on, true, mo_release);
+    }
+}
+
+// return idle blocks to the OS every second
+void GlobalAlloc::_scavenger() {
+    std::unique_lock<std::mutex> g(_sm);
+    while (!_scav_stop) {
+        _scv.wait_for(g, std::chrono::milliseconds(1000));
+        if (_scav_stop) break;
+        g.unlock();
+        this->scavenge();
+        g.lock();
+    }
+    _scav_done = true;
+    _scv.notify_one();
+}
+
+// decommit a free block, and free the huge block if none of its blocks is used
+inline void GlobalAlloc::_release(X& x, void* p, HugeBlock* hb) {
+    _vm_decommit_block(p, 1u << g_lb_bits, hb->clear_hugetlb(p));
+    atomic_dec(&_nlb, mo_relaxed);
     bool r;
     {
         std::lock_guard<std::mutex> g(x.mtx);
         r = hb->free(p) && hb != x.hb;
         if (r) x.lhb.erase(hb);
     }
-    if (r) _vm_free(hb, 1u << g_hb_bits);
+    if (r) {
+        _vm_free(hb, 1u << g_hb_bits);
+        atomic_dec(&_nhb, mo_relaxed);
+    }
 }
 
 inline LargeBlock* GlobalAlloc::make_large_block(uint32 alloc_id) {
@@ -741,9 +1065,113 @@ inline LargeAlloc* GlobalAlloc::make_large_alloc(uint32 alloc_id) {
     return p ? new (p) LargeAlloc(parent, talloc()) : NULL;
 }
 
-inline SmallAlloc* make_small_alloc(LargeBlock* lb, ThreadAlloc* ta) {
+inline void* GlobalAlloc::sys_alloc(size_t n, bool zero) {
+    void* p = zero ? ::calloc(1, n) : ::malloc(n);
+    if (p) {
+        atomic_inc(&_sys_n, mo_relaxed);
+        atomic_add(&_sys_b, n, mo_relaxed);
+    }
+    return p;
+}
+
+inline void* GlobalAlloc::sys_realloc(void* p, size_t o, size_t n) {
+    void* x = ::realloc(p, n);
+    if (x) atomic_add(&_sys_b, n - o, mo_relaxed);
+    return x;
+}
+
+inline void GlobalAlloc::sys_free(void* p, size_t n) {
+    ::free(p);
+    atomic_sub(&_sys_b, n, mo_relaxed);
+}
+
+void GlobalAlloc::add_talloc(ThreadAlloc* ta) {
+    std::lock_guard<std::mutex> g(_tm);
+    _tl.push_back(ta);
+}
+
+void GlobalAlloc::abandon(ThreadAlloc* ta) {
+    std::lock_guard<std::mutex> g(_tm);
+    ta->onext() = _orphans;
+    _orphans = ta;
+}
+
+ThreadAlloc* GlobalAlloc::adopt() {
+    std::lock_guard<std::mutex> g(_tm);
+    const auto ta = _orphans;
+    if (ta) {
+        _orphans = ta->onext();
+        ta->onext() = 0;
+    }
+    return ta;
+}
+
+mem_stat GlobalAlloc::stats(const std::function<void(uint32, const mem_stat&)>& f) {
+    mem_stat r, s;
+    memset(&r, 0, sizeof(r));
+    size_t x[4] = { 0 }; // frees across threads: count, reclaimed, small bytes, large bytes
+    {
+        std::lock_guard<std::mutex> g(_tm);
+        // load the remote counters first, so that the differences below are not negative
+        for (auto k = _tl.front(); k; k = k->next) ((ThreadAlloc*)k)->xstats(x);
+        for (auto k = _tl.front(); k; k = k->next) {
+            const auto ta = (ThreadAlloc*)k;
+            ta->stats(s);
+            r.small_blocks += s.small_blocks;
+            r.small_in_use += s.small_in_use;
+            r.large_blocks += s.large_blocks;
+            r.large_in_use += s.large_in_use;
+            if (f) f(ta->id(), s);
+        }
+    }
+    r.small_in_use = r.small_in_use > x[2] ? r.small_in_use - x[2] : 0;
+    r.large_in_use = r.large_in_use > x[3] ? r.large_in_use - x[3] : 0;
+    r.xfree_pending = x[0] > x[1] ? x[0] - x[1] : 0;
+
+    const size_t nhb = atomic_load(&_nhb, mo_relaxed);
+    r.reserved = nhb << g_hb_bits;
+    r.retained = atomic_load(&_nfb, mo_relaxed) << g_lb_bits;
+    r.committed = (atomic_load(&_nlb, mo_relaxed) << g_lb_bits) + nhb * 4096;
+    r.sys_allocs = atomic_load(&_sys_n, mo_relaxed);
+    r.sys_in_use = atomic_load(&_sys_b, mo_relaxed);
+    r.in_use = r.small_in_use + r.large_in_use + r.sys_in_use;
+    return r;
+}
+
+void ThreadAlloc::stats(mem_stat& s) const {
+    memset(&s, 0, sizeof(s));
+    s.small_blocks = atomic_load(&_nsa, mo_relaxed);
+    s.small_in_use = atomic_load(&_sbytes, mo_relaxed);
+    s.large_blocks = atomic_load(&_nla, mo_relaxed);
+    s.large_in_use = atomic_load(&_lbytes, mo_relaxed);
+    s.committed = (atomic_load(&_nlb, mo_relaxed) + s.large_blocks) << g_lb_bits;
+    s.in_use = s.small_in_use + s.large_in_use;
+}
+
+// add counters of frees across threads to @x
+void ThreadAlloc::xstats(size_t* x) const {
+    x[0] += atomic_load(&_xn, mo_relaxed);
+    x[1] += atomic_load(&_xr, mo_relaxed);
+    x[2] += atomic_load(&_xsbytes, mo_relaxed);
+    x[3] += atomic_load(&_xlbytes, mo_relaxed);
+}
+
+inline LargeBlock* ThreadAlloc::_make_large_block() {
+    auto lb = _ga->make_large_block(_id);
+    if (lb) _stat_add(_nlb, 1);
+    return lb;
+}
+
+inline LargeAlloc* ThreadAlloc::_make_large_alloc() {
+    auto la = _ga->make_large_alloc(_id);
+    if (la) _stat_add(_nla, 1);
+    return la;
+}
+
+inline SmallAlloc* ThreadAlloc::_make_small_alloc(LargeBlock* lb) {
     auto p = lb->alloc();
-    return p ? new(p) SmallAlloc(lb, ta) : NULL;
+    if (p) _stat_add(_nsa, 1);
+    return p ? new(p) SmallAlloc(lb, this) : NULL;
 }
 
 inline void* ThreadAlloc::alloc(size_t n) {
@@ -762,7 +1190,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
             }
         }
 
-        if (_lb && (sa = make_small_alloc(_lb, this))) {
+        if (_lb && (sa = this->_make_small_alloc(_lb))) {
             _lsa.push_front(sa);
             p = sa->alloc(u);
             goto end;
@@ -770,7 +1198,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
 
         if (_lb && _lb->next) {
             _try_alloc(_llb, 4, k) {
-                if ((sa = make_small_alloc((LargeBlock*)k, this))) {
+                if ((sa = this->_make_small_alloc((LargeBlock*)k))) {
                     _llb.move_front(k);
                     _lsa.push_front(sa);
                     p = sa->alloc(u);
@@ -780,10 +1208,10 @@ inline void* ThreadAlloc::alloc(size_t n) {
         }
 
         {
-            auto lb = _ga->make_large_block(_id);
+            auto lb = this->_make_large_block();
             if (lb) {
                 _llb.push_front(lb);
-                sa = make_small_alloc(lb, this);
+                sa = this->_make_small_alloc(lb);
                 _lsa.push_front(sa);
                 p = sa->alloc(u);
             }
@@ -804,7 +1232,7 @@ inline void* ThreadAlloc::alloc(size_t n) {
         }
 
         {
-            auto la = _ga->make_large_alloc(_id);
+            auto la = this->_make_large_alloc();
             if (la) {
                 _lla.push_front(la);
                 p = la->alloc(u);
@@ -813,10 +1241,17 @@ inline void* ThreadAlloc::alloc(size_t n) {
         }
 
     } else {
-        p = ::malloc(n);
+        return _ga->sys_alloc(n);
     }
 
   end:
+    if (p) {
+        if (n <= 2048) {
+            _stat_add(_sbytes, _small_size(n));
+        } else {
+            _stat_add(_lbytes, god::align_up<4096>(n));
+        }
+    }
     return p;
 }
 
@@ -831,7 +1266,7 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
         const uint32 u = n > 16 ? god::nb<16>((uint32)n) : 1;
         if (_sa && (p = _sa->alloc(u, a))) goto end;
 
-        if (_lb && (sa = make_small_alloc(_lb, this))) {
+        if (_lb && (sa = this->_make_small_alloc(_lb))) {
             _lsa.push_front(sa);
             p = sa->alloc(u, a);
             goto end;
@@ -839,7 +1274,7 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
 
         if (_lb && _lb->next) {
             _try_alloc(_llb, 4, k) {
-                if ((sa = make_small_alloc((LargeBlock*)k, this))) {
+                if ((sa = this->_make_small_alloc((LargeBlock*)k))) {
                     _llb.move_front(k);
                     _lsa.push_front(sa);
                     p = sa->alloc(u, a);
@@ -849,20 +1284,21 @@ inline void* ThreadAlloc::alloc(size_t n, size_t align) {
         }
 
         {
-            auto lb = _ga->make_large_block(_id);
+            auto lb = this->_make_large_block();
             if (lb) {
                 _llb.push_front(lb);
-                sa = make_small_alloc(lb, this);
+                sa = this->_make_small_alloc(lb);
                 _lsa.push_front(sa);
                 p = sa->alloc(u, a);
             }
             goto end;
         }
     } else {
-        p = this->alloc(n);
+        return this->alloc(n);
     }
 
   end:
+    if (p) _stat_add(_sbytes, _small_size(n));
     return p;
 }
 
@@ -872,15 +1308,20 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             const auto sa = (SmallAlloc*) god::align_down<1u << g_sb_bits>(p);
             const auto ta = sa->talloc();
             if (ta == this) {
+                _stat_sub(_sbytes, _small_size(n));
                 if (sa->free(p) && sa != _sa) {
                     _lsa.erase(sa);
+                    _stat_sub(_nsa, 1);
                     const auto lb = sa->parent();
                     if (lb->free(sa) && lb != _lb) {
                         _llb.erase(lb);
+                        _stat_sub(_nlb, 1);
                         _ga->free(lb, lb->parent(), _id);
                     }
                 }
             } else {
+                _stat_add(_xn, 1);
+                _stat_add(_xsbytes, _small_size(n));
                 sa->xfree(p);
             }
 
@@ -888,23 +1329,27 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             const auto la = (LargeAlloc*) god::align_down<1u << g_lb_bits>(p);
             const auto ta = la->talloc();
             if (ta == this) {
+                _stat_sub(_lbytes, god::align_up<4096>(n));
                 if (la->free(p) && la != _la) {
                     _lla.erase(la);
+                    _stat_sub(_nla, 1);
                     _ga->free(la, la->parent(), _id);
                 }
             } else {
+                _stat_add(_xn, 1);
+                _stat_add(_xlbytes, god::align_up<4096>(n));
                 la->xfree(p);
             }
 
         } else {
-            ::free(p);
+            _ga->sys_free(p, n);
         }
     }
 }
 
 inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
     if (unlikely(!p)) return this->alloc(n);
-    if (unlikely(o > g_max_alloc_size)) return ::realloc(p, n);
+    if (unlikely(o > g_max_alloc_size)) return _ga->sys_realloc(p, o, n);
     CHECK_LT(o, n) << "realloc error, new size must be greater than old size..";
 
     if (o <= 2048) {
@@ -915,7 +1360,7 @@ inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
         if (sa == _sa && n <= 2048) {
             const uint32 l = god::nb<16>((uint32)n);
             auto x = sa->realloc(p, k >> 4, l);
-            if (x) return x;
+            if (x) { _stat_add(_sbytes, (l << 4) - k); return x; }
         }
 
     } else {
@@ -926,7 +1371,7 @@ inline void* ThreadAlloc::realloc(void* p, size_t o, size_t n) {
         if (la == _la && n <= g_max_alloc_size) {
             const uint32 l = god::nb<4096>((uint32)n);
             auto x = la->realloc(p, k >> 12, l);
-            if (x) return x;
+            if (x) { _stat_add(_lbytes, ((size_t)l << 12) - k); return x; }
         }
     }
 
@@ -946,7 +1391,9 @@ inline void* ThreadAlloc::try_realloc(void* p, size_t o, size_t n) {
         const auto sa = (SmallAlloc*) god::align_down<1u << g_sb_bits>(p);
         if (sa == _sa && n <= 2048) {
             const uint32 l = god::nb<16>((uint32)n);
-            return sa->realloc(p, k >> 4, l);
+            auto x = sa->realloc(p, k >> 4, l);
+            if (x) _stat_add(_sbytes, (l << 4) - k);
+            return x;
         }
 
     } else {
@@ -956,7 +1403,9 @@ inline void* ThreadAlloc::try_realloc(void* p, size_t o, size_t n) {
         const auto la = (LargeAlloc*) god::align_down<1u << g_lb_bits>(p);
         if (la == _la && n <= g_max_alloc_size) {
             const uint32 l = god::nb<4096>((uint32)n);
-            return la->realloc(p, k >> 12, l);
+            auto x = la->realloc(p, k >> 12, l);
+            if (x) _stat_add(_lbytes, ((size_t)l << 12) - k);
+            return x;
         }
     }
 
@@ -967,7 +1416,7 @@ inline void* ThreadAlloc::try_realloc(void* p, size_t o, size_t n) {
 
 void* _salloc(size_t n) {
     assert(n <= 4096);
-    return xx::talloc()->salloc(n);
+    return _talloc()->salloc(n);
 }
 
 void _dealloc(std::function<void()>&& f, int x) {
@@ -976,23 +1425,32 @@ void _dealloc(std::function<void()>&& f, int x) {
 
 #ifndef CO_USE_SYS_MALLOC
 void* alloc(size_t n) {
-    return xx::talloc()->alloc(n);
+    return _talloc()->alloc(n);
 }
 
 void* alloc(size_t n, size_t align) {
-    return xx::talloc()->alloc(n, align);
+    return _talloc()->alloc(n, align);
 }
 
 void free(void* p, size_t n) {
-    return xx::talloc()->free(p, n);
+    return _talloc()->free(p, n);
 }
 
 void* realloc(void* p, size_t o, size_t n) {
-    return xx::talloc()->realloc(p, o, n);
+    return _talloc()->realloc(p, o, n);
 }
 
 void* try_realloc(void* p, size_t o, size_t n) {
-    return xx::talloc()->try_realloc(p, o, n);
+    return _talloc()->try_realloc(p, o, n);
+}
+
+void* zalloc(size_t size) {
+    if (size <= xx::g_max_alloc_size) {
+        auto p = co::alloc(size);
+        if (p) memset(p, 0, size);
+        return p;
+    }
+    return xx::g_ga->sys_alloc(size, true);
 }
 
 #else
@@ -1001,15 +1459,55 @@ void* alloc(size_t n, size_t) { return ::malloc(n); }
 void free(void* p, size_t) { ::free(p); }
 void* realloc(void* p, size_t, size_t n) { return ::realloc(p, n); }
 void* try_realloc(void*, size_t, size_t) { return NULL; }
+void* zalloc(size_t size) { return ::calloc(1, size); }
 #endif
 
-void* zalloc(size_t size) {
-    if (size <= xx::g_max_alloc_size) {
-        auto p = co::alloc(size);
-        if (p) memset(p, 0, size);
-        return p;
+void mem_scavenge() {
+    xx::g_ga->scavenge();
+}
+
+mem_stat mem_stats(const std::function<void(uint32, const mem_stat&)>& f) {
+    // @f is called with the list of thread-local allocators locked, make sure 
+    // the allocator of this thread exists, or @f may deadlock when it allocates.
+    xx::Talloc t;
+    (void)t;
+    return xx::g_ga->stats(f);
+}
+
+static void _add_stats(json::Json& j, const mem_stat& s, bool global) {
+    // percentage of the memory in use in small or large blocks
+    auto occ = [](size_t used, size_t blocks, uint32 bits) {
+        return blocks ? (double)used * 100 / (double)(blocks << bits) : 0.0;
+    };
+    if (global) j.add_member("reserved", (uint64)s.reserved);
+    j.add_member("committed", (uint64)s.committed);
+    if (global) j.add_member("retained", (uint64)s.retained);
+    j.add_member("in_use", (uint64)s.in_use);
+    j.add_member("small_blocks", (uint64)s.small_blocks);
+    j.add_member("small_in_use", (uint64)s.small_in_use);
+    j.add_member("small_occupancy", occ(s.small_in_use, s.small_blocks, xx::g_sb_bits));
+    j.add_member("large_blocks", (uint64)s.large_blocks);
+    j.add_member("large_in_use", (uint64)s.large_in_use);
+    j.add_member("large_occupancy", occ(s.large_in_use, s.large_blocks, xx::g_lb_bits));
+    if (global) {
+        j.add_member("xfree_pending", (uint64)s.xfree_pending);
+        j.add_member("sys_allocs", (uint64)s.sys_allocs);
+        j.add_member("sys_in_use", (uint64)s.sys_in_use);
     }
-    return ::calloc(1, size);
+}
+
+fastring mem_stats_json() {
+    json::Json threads = json::array();
+    const mem_stat s = mem_stats([&threads](uint32 id, const mem_stat& x) {
+        json::Json t;
+        t.add_member("id", id);
+        _add_stats(t, x, false);
+        threads.push_back(t);
+    });
+    json::Json r;
+    _add_stats(r, s, true);
+    r.add_member("threads", threads);
+    return r.str();
 }
 
 char* strdup(const char* s) {
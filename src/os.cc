@@ -1,9 +1,15 @@
 #ifndef _WIN32
 
 #include "co/os.h"
+#include "co/stl.h"
 #include <stdio.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
 #endif
@@ -68,6 +74,95 @@ size_t pagesize() {
     return (size_t) sysconf(_SC_PAGESIZE);
 }
 
+#ifdef __linux__
+// read an integer from a file in sysfs, return -1 on error
+inline int _read_int(const char* path) {
+    int v = -1;
+    FILE* f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%d", &v) != 1) v = -1;
+        fclose(f);
+    }
+    return v;
+}
+
+// the NUMA node of a cpu, it is the nodeN entry in /sys/devices/system/cpu/cpuX
+inline int _cpu_node(const char* dir) {
+    int node = 0;
+    DIR* d = opendir(dir);
+    if (d) {
+        while (struct dirent* e = readdir(d)) {
+            if (strncmp(e->d_name, "node", 4) == 0 && '0' <= e->d_name[4] && e->d_name[4] <= '9') {
+                node = atoi(e->d_name + 4);
+                break;
+            }
+        }
+        closedir(d);
+    }
+    return node;
+}
+
+static co::vector<cpu_t> _get_cpus() {
+    co::vector<cpu_t> v(64);
+    co::hash_map<int64, int> cores; // (package, core_id) -> core
+    char path[128];
+    const int n = (int) sysconf(_SC_NPROCESSORS_CONF);
+    for (int i = 0; i < n; ++i) {
+        // offline processors have no topology
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        const int core_id = _read_int(path);
+        if (core_id < 0) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        const int pkg = _read_int(path);
+
+        const int64 key = ((int64)pkg << 32) | (uint32)core_id;
+        auto it = cores.find(key);
+        if (it == cores.end()) it = cores.insert(std::make_pair(key, (int)cores.size())).first;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", i);
+        v.push_back(cpu_t{ i, it->second, _cpu_node(path) });
+    }
+
+    if (v.empty()) {
+        const int m = os::cpunum();
+        for (int i = 0; i < m; ++i) v.push_back(cpu_t{ i, i, 0 });
+    }
+    return v;
+}
+
+bool bind_cpu(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+static co::vector<cpu_t> _get_cpus() {
+    const int m = os::cpunum();
+    co::vector<cpu_t> v(m);
+    for (int i = 0; i < m; ++i) v.push_back(cpu_t{ i, i, 0 });
+    return v;
+}
+
+bool bind_cpu(int) { return false; }
+#endif
+
+const co::vector<cpu_t>& cpus() {
+    static co::vector<cpu_t> v = _get_cpus();
+    return v;
+}
+
+int numa_nodes() {
+    static int n = []() {
+        int x = 0;
+        for (auto& c : os::cpus()) if (x <= c.node) x = c.node + 1;
+        return x;
+    }();
+    return n;
+}
+
 #ifdef __linux__
 fastring exepath() {
     fastring s(128);
@@ -106,6 +106,56 @@ size_t pagesize() {
     return (size_t) info.dwPageSize;
 }
 
+static co::vector<cpu_t> _get_cpus() {
+    const int m = os::cpunum();
+    co::vector<cpu_t> v(m);
+    for (int i = 0; i < m; ++i) v.push_back(cpu_t{ i, i, 0 });
+
+    // find SMT siblings and NUMA nodes of processors in group 0
+    DWORD len = 0;
+    GetLogicalProcessorInformation(NULL, &len);
+    const DWORD k = len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+    if (k == 0) return v;
+    co::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> x(k);
+    x.resize(k);
+    if (!GetLogicalProcessorInformation(x.data(), &len)) return v;
+
+    int core = 0;
+    for (DWORD i = 0; i < k; ++i) {
+        const auto& e = x[i];
+        if (e.Relationship != RelationProcessorCore && e.Relationship != RelationNumaNode) continue;
+        for (int c = 0; c < m && c < 64; ++c) {
+            if (!(e.ProcessorMask & ((ULONG_PTR)1 << c))) continue;
+            if (e.Relationship == RelationProcessorCore) {
+                v[c].core = core;
+            } else {
+                v[c].node = (int) e.NumaNode.NodeNumber;
+            }
+        }
+        if (e.Relationship == RelationProcessorCore) ++core;
+    }
+    return v;
+}
+
+const co::vector<cpu_t>& cpus() {
+    static co::vector<cpu_t> v = _get_cpus();
+    return v;
+}
+
+int numa_nodes() {
+    static int n = []() {
+        int x = 0;
+        for (auto& c : os::cpus()) if (x <= c.node) x = c.node + 1;
+        return x;
+    }();
+    return n;
+}
+
+bool bind_cpu(int cpu) {
+    if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
 void daemon() {}
 
 sig_handler_t signal(int sig, sig_handler_t handler, int) {
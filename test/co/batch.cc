@@ -0,0 +1,38 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 100000, "number of coroutines to start");
+DEF_uint32(r, 10, "rounds of the test");
+
+// start FLG_n coroutines with go() or go_batch(), and wait for them to finish
+int64 fan_out(bool batch) {
+    co::wait_group wg(FLG_n);
+    co::vector<co::Closure*> cbs(FLG_n);
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        cbs.push_back(co::new_closure([wg]() { wg.done(); }));
+    }
+
+    co::Timer t;
+    if (batch) {
+        co::go_batch(cbs);
+    } else {
+        for (size_t i = 0; i < cbs.size(); ++i) go(cbs[i]);
+    }
+    const int64 us = t.us();
+    wg.wait();
+    return us;
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("schedulers: ", co::sched_num(), ", coroutines: ", FLG_n);
+    fan_out(true); // warm up
+
+    for (uint32 i = 0; i < FLG_r; ++i) {
+        const int64 a = fan_out(false);
+        const int64 b = fan_out(true);
+        co::print("go: ", a, " us, go_batch: ", b, " us");
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEC_uint32(co_mutex_spin);
+DEF_uint32(n, 100000, "number of lock operations per coroutine");
+DEF_uint32(c, 4, "number of coroutines per scheduler");
+DEF_uint32(cs, 100, "work in the critical section, in loop iterations");
+DEF_uint32(out, 200, "work out of the critical section, in loop iterations");
+
+static uint64 g_shared[8];
+
+inline uint64 work(uint64 x, uint32 n) {
+    for (uint32 i = 0; i < n; ++i) x = x * 6364136223846793005ull + 1442695040888963407ull;
+    return x;
+}
+
+// FLG_c coroutines on each of the first @s schedulers contend for a mutex, 
+// return the average time in ns of an operation (lock, work and unlock).
+int64 bench(uint32 s) {
+    co::mutex m;
+    auto& scheds = co::scheds();
+    co::wait_group wg(s * FLG_c);
+    co::Timer t;
+    for (uint32 i = 0; i < s; ++i) {
+        for (uint32 k = 0; k < FLG_c; ++k) {
+            scheds[i]->go([wg, m]() {
+                uint64 x = co::coroutine_id();
+                for (uint32 j = 0; j < FLG_n; ++j) {
+                    {
+                        co::mutex_guard g(m);
+                        g_shared[j & 7] = work(g_shared[j & 7], FLG_cs);
+                    }
+                    x = work(x, FLG_out);
+                }
+                if (x == 7) co::print(x); // do not optimize it away
+                wg.done();
+            });
+        }
+    }
+    wg.wait();
+    return t.ns() / ((int64)s * FLG_c * FLG_n);
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    const uint32 spin = FLG_co_mutex_spin;
+    const uint32 num = (uint32)co::sched_num();
+    co::print(
+        "schedulers: ", num, ", coroutines per scheduler: ", FLG_c, 
+        ", ops per coroutine: ", FLG_n, ", max spins: ", spin
+    );
+
+    for (uint32 s = 1;; s = s * 2 < num ? s * 2 : num) {
+        FLG_co_mutex_spin = 0;
+        const int64 t0 = bench(s);
+        FLG_co_mutex_spin = spin;
+        const int64 t1 = bench(s);
+        co::print(s, " schedulers: ", t0, " ns/op without spinning, ", t1, " ns/op with spinning");
+        if (s == num) break;
+    }
+    return 0;
+}
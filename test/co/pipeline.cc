@@ -0,0 +1,68 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 1000000, "number of messages per producer");
+DEF_uint32(p, 2, "number of producers");
+DEF_uint32(cap, 1024, "capacity of the channel");
+DEF_uint32(batch, 1, "batch size of read_n() and write_n(), 1 for >> and <<");
+
+// FLG_p producer coroutines write FLG_n messages each to a channel, and a 
+// consumer coroutine reads them all. Producers and the consumer are spread 
+// over the schedulers. If FLG_batch > 1, messages are moved in batches with 
+// chan::read_n() and chan::write_n().
+template<typename T>
+void bench(const char* name, const T& v) {
+    co::chan<T> ch(FLG_cap);
+    co::wait_group wg(FLG_p + 1);
+    const uint64 total = (uint64)FLG_n * FLG_p;
+
+    co::Timer t;
+    if (FLG_batch <= 1) {
+        go([ch, wg, total]() {
+            T x;
+            for (uint64 i = 0; i < total; ++i) ch >> x;
+            wg.done();
+        });
+        for (uint32 i = 0; i < FLG_p; ++i) {
+            go([ch, wg, v]() {
+                for (uint32 k = 0; k < FLG_n; ++k) ch << v;
+                wg.done();
+            });
+        }
+    } else {
+        go([ch, wg, total, v]() {
+            co::vector<T> x(FLG_batch, v);
+            for (uint64 i = 0; i < total;) {
+                const uint64 r = total - i;
+                i += ch.read_n(x.data(), (size_t)(r < FLG_batch ? r : FLG_batch));
+            }
+            wg.done();
+        });
+        for (uint32 i = 0; i < FLG_p; ++i) {
+            go([ch, wg, v]() {
+                co::vector<T> x(FLG_batch, v);
+                for (uint32 k = 0; k < FLG_n; k += FLG_batch) {
+                    const uint32 r = FLG_n - k;
+                    ch.write_n(x.data(), r < FLG_batch ? r : FLG_batch);
+                }
+                wg.done();
+            });
+        }
+    }
+    wg.wait();
+
+    const int64 ns = t.ns();
+    co::print(
+        "chan<", name, ">: ", total, " messages in ", ns / 1000000, " ms, ",
+        ns / total, " ns per message, ", (uint64)(total * 1e9 / ns), " messages/s"
+    );
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("producers: ", FLG_p, ", messages per producer: ", FLG_n, ", cap: ", FLG_cap, ", batch: ", FLG_batch);
+    bench<int>("int", 7);
+    bench<fastring>("fastring", fastring("hello world"));
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/rand.h"
+#include "co/str.h"
+#include "co/time.h"
+
+DEF_uint32(n, 100000, "number of operations per coroutine");
+DEF_uint32(c, 0, "number of coroutines, 0 for 4 times the number of schedulers");
+DEF_string(w, "1,10,50,99", "write ratios in percent");
+
+// a small read-mostly cache, looked up by readers and updated by writers
+static co::hash_map<uint32, uint64> g_cache;
+
+inline uint64 read_cache(uint32 k) {
+    auto it = g_cache.find(k & 1023);
+    return it != g_cache.end() ? it->second : 0;
+}
+
+inline void write_cache(uint32 k) {
+    ++g_cache[k & 1023];
+}
+
+// FLG_c coroutines over all the schedulers, each does FLG_n lookups or 
+// updates of the cache, @w percent of them are updates.
+template<typename L>
+int64 bench(L&& lock, uint32 w) {
+    const uint32 c = FLG_c > 0 ? FLG_c : co::sched_num() * 4;
+    co::wait_group wg(c);
+    co::Timer t;
+    for (uint32 i = 0; i < c; ++i) {
+        go([wg, &lock, w]() {
+            uint32 seed = co::rand();
+            uint64 x = 0;
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                const uint32 r = co::rand(seed);
+                x += lock(r % 100 < w, r);
+            }
+            if (x == 7) co::print(x); // do not optimize it away
+            wg.done();
+        });
+    }
+    wg.wait();
+    return t.ns();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    for (uint32 i = 0; i < 1024; ++i) g_cache[i] = i;
+
+    co::mutex m;
+    co::rwmutex rw;
+    const uint32 c = FLG_c > 0 ? FLG_c : co::sched_num() * 4;
+    co::print("schedulers: ", co::sched_num(), ", coroutines: ", c, ", ops per coroutine: ", FLG_n);
+
+    auto v = str::split(FLG_w, ',');
+    for (auto& s : v) {
+        const uint32 w = str::to_uint32(s);
+        const uint64 total = (uint64)c * FLG_n;
+
+        const int64 t0 = bench([&m](bool wr, uint32 k) -> uint64 {
+            co::mutex_guard g(m);
+            if (wr) { write_cache(k); return 0; }
+            return read_cache(k);
+        }, w);
+
+        const int64 t1 = bench([&rw](bool wr, uint32 k) -> uint64 {
+            if (wr) {
+                co::unique_lock g(rw);
+                write_cache(k);
+                return 0;
+            }
+            co::shared_lock g(rw);
+            return read_cache(k);
+        }, w);
+
+        co::print(
+            "write ", w, "%: mutex ", t0 / total, " ns/op, rwmutex ", t1 / total,
+            " ns/op, speedup ", (double)t0 / t1
+        );
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 200000, "number of acquire/release per coroutine");
+DEF_uint32(c, 16, "number of coroutines");
+DEF_uint32(limit, 4, "number of permits (tokens)");
+
+// FLG_c coroutines over the schedulers take a permit and give it back FLG_n 
+// times each, they sleep(0) now and then while holding the permit, so that 
+// others have to wait for it. Return the average time in ns of an operation.
+template<typename A, typename R>
+int64 bench(A&& acquire, R&& release) {
+    co::wait_group wg(FLG_c);
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        go([wg, &acquire, &release]() {
+            for (uint32 k = 0; k < FLG_n; ++k) {
+                acquire();
+                if ((k & 63) == 0) co::sleep(0);
+                release();
+            }
+            wg.done();
+        });
+    }
+    wg.wait();
+    return t.ns() / ((int64)FLG_c * FLG_n);
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("coroutines: ", FLG_c, ", permits: ", FLG_limit, ", ops per coroutine: ", FLG_n);
+
+    // a channel used as a token bucket
+    co::chan<int> ch(FLG_limit);
+    for (uint32 i = 0; i < FLG_limit; ++i) ch << 1;
+    const int64 t0 = bench(
+        [&ch]() { int x; ch >> x; },
+        [&ch]() { ch << 1; }
+    );
+
+    co::semaphore sem(FLG_limit);
+    const int64 t1 = bench(
+        [&sem]() { sem.acquire(); },
+        [&sem]() { sem.release(); }
+    );
+
+    co::print("chan<int>: ", t0, " ns/op, semaphore: ", t1, " ns/op");
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(t, 300, "time(ms) the coroutine runs without yielding");
+DEF_bool(y, false, "call co::maybe_yield() in the loop");
+
+// Spin for FLG_t ms in a coroutine, while another coroutine in the same scheduler 
+// ticks every 10 ms. Run with -co_stall_ms 100, the watchdog will log the blocked 
+// scheduler with the coroutine id and its stack trace. With -y, the coroutine 
+// yields when its time slice is used up, and the ticks are delayed only a little.
+void spin() {
+    co::print("co ", co::coroutine_id(), " spins for ", FLG_t, " ms");
+    co::Timer t;
+    while (t.ms() < FLG_t) {
+        if (FLG_y) co::maybe_yield();
+    }
+}
+
+DEF_main(argc, argv) {
+    auto s = co::next_sched();
+    co::wait_group wg(2);
+    bool done = false;
+
+    s->go([wg, &done]() {
+        int64 max = 0;
+        co::Timer t;
+        while (!done) {
+            co::sleep(10);
+            const int64 us = t.us();
+            if (us > max) max = us;
+            t.restart();
+        }
+        co::print("max interval between ticks: ", max / 1000, " ms");
+        wg.done();
+    });
+    s->go([wg, &done]() {
+        spin();
+        done = true;
+        wg.done();
+    });
+
+    wg.wait();
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 4096, "number of coroutines created in a burst");
+DEF_uint32(us, 50, "cpu time (us) each coroutine takes");
+
+// run this test with and without -co_steal to see the difference:
+//   ./steal -co_steal
+DEF_main(argc, argv) {
+    co::vector<int> c(co::sched_num(), 0);
+    co::wait_group wg(FLG_n);
+
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        go([wg, &c]() {
+            co::Timer x;
+            while (x.us() < FLG_us);
+            atomic_inc(&c[co::sched_id()], mo_relaxed);
+            wg.done();
+        });
+    }
+    wg.wait();
+    const int64 us = t.us();
+
+    auto& s = co::scheds();
+    for (size_t i = 0; i < s.size(); ++i) {
+        co::print(
+            "sched ", i, " run: ", c[i], " steals: ", s[i]->steals(),
+            " stolen tasks: ", s[i]->stolen_tasks()
+        );
+    }
+    co::print("done in ", us, " us");
+    return 0;
+}
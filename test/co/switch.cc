@@ -0,0 +1,80 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(c, 16, "number of coroutines switching with each other");
+DEF_uint32(n, 100000, "number of switches per coroutine");
+
+// Grow the stack by about @kb KB, and then switch coroutines for FLG_n times.
+// Each switch puts the current coroutine to the ready queue, and yields to the
+// scheduler, which will resume the next coroutine.
+void deep_switch(uint32 kb) {
+    if (kb > 0) {
+        volatile char buf[1024];
+        buf[0] = buf[1023] = (char)kb;
+        deep_switch(kb - 1);
+        (void) buf[0];
+        return;
+    }
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        co::resume(co::coroutine());
+        co::yield();
+    }
+}
+
+void bench(uint32 kb, bool dedicated) {
+    auto s = co::next_sched();
+    co::wait_group wg(FLG_c);
+    const uint64 copies = s->stack_copies();
+    const uint64 bytes = s->stack_bytes();
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        auto f = [wg, kb]() { deep_switch(kb); wg.done(); };
+        dedicated ? s->go_dedicated(f) : s->go(f);
+    }
+    wg.wait();
+
+    const int64 ns = t.ns();
+    const uint64 total = (uint64)FLG_c * FLG_n;
+    co::print(
+        dedicated ? "dedicated" : "shared   ", " stack, depth ", kb, " KB: ",
+        total, " switches in ", ns / 1000000, " ms, ", ns / total, " ns per switch, ",
+        s->stack_copies() - copies, " stack copies, ", (s->stack_bytes() - bytes) >> 20, " MB saved"
+    );
+}
+
+// Two hot coroutines switch with each other, while 7 coroutines started between 
+// them are sleeping, and end later. With stacks chosen by coroutine id, the hot 
+// ones may share a stack while others are empty.
+void bench_hot_pair() {
+    auto s = co::next_sched();
+    co::wait_group wg(9);
+    co::event ev;
+    const uint64 copies = s->stack_copies();
+    co::Timer t;
+    s->go([wg, ev]() { ev.wait(); deep_switch(4); wg.done(); });
+    for (int i = 0; i < 7; ++i) s->go([wg]() { co::sleep(10); wg.done(); });
+    ev.signal();
+    sleep::ms(1);
+    s->go([wg]() { deep_switch(4); wg.done(); });
+    wg.wait();
+
+    const int64 ns = t.ns();
+    const uint64 total = (uint64)2 * FLG_n;
+    co::print(
+        "hot pair, depth 4 KB: ", total, " switches in ", ns / 1000000, " ms, ",
+        ns / total, " ns per switch, ", s->stack_copies() - copies, " stack copies"
+    );
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("coroutines: ", FLG_c, ", switches per coroutine: ", FLG_n);
+    bench_hot_pair();
+    const uint32 depth[] = { 0, 4, 16, 64 };
+    for (auto kb : depth) {
+        bench(kb, false);
+        bench(kb, true);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+#include "../../src/co/sched.h"
+#include <mutex>
+#include <thread>
+
+DEF_uint32(t, 16, "number of producer threads");
+DEF_uint32(n, 100000, "number of tasks pushed by each producer");
+
+// the mutex version of the task queue used by the scheduler before
+class MutexQueue {
+  public:
+    MutexQueue() : _v(512) {}
+
+    void push(void* x) {
+        std::lock_guard<std::mutex> g(_mtx);
+        _v.push_back(x);
+    }
+
+    void pop_all(co::vector<void*>& v) {
+        std::lock_guard<std::mutex> g(_mtx);
+        if (!_v.empty()) _v.swap(v);
+    }
+
+  private:
+    std::mutex _mtx;
+    co::vector<void*> _v;
+};
+
+// the task queue used by the scheduler
+template<typename T>
+using LockFreeQueue = co::xx::TaskQueue<T>;
+
+// producers push tasks to the queue, and a single consumer pops them in batch
+template<typename Q>
+void bench(const char* name) {
+    Q q;
+    const uint64 total = (uint64)FLG_t * FLG_n;
+    co::vector<std::thread> v(FLG_t);
+    co::Timer t;
+
+    for (uint32 i = 0; i < FLG_t; ++i) {
+        v.emplace_back([&q]() {
+            for (uint32 k = 0; k < FLG_n; ++k) q.push((void*)(size_t)(k + 1));
+        });
+    }
+
+    uint64 n = 0, batches = 0;
+    co::vector<void*> tasks(512);
+    while (n < total) {
+        q.pop_all(tasks);
+        if (!tasks.empty()) {
+            n += tasks.size();
+            ++batches;
+            tasks.clear();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto& x : v) x.join();
+    const int64 us = t.us();
+    co::print(
+        name, ": ", total, " tasks in ", us, " us, ", (total * 1000 / (us + 1)), " tasks/ms, ",
+        "avg batch size: ", (batches ? total / batches : 0)
+    );
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    co::print("producers: ", FLG_t, ", tasks per producer: ", FLG_n);
+    bench<MutexQueue>("mutex    ");
+    bench<LockFreeQueue<void>>("lock-free");
+    return 0;
+}
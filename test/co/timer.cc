@@ -0,0 +1,40 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/rand.h"
+#include "co/time.h"
+
+DEF_uint32(c, 100000, "number of idle coroutines with a long timeout");
+DEF_uint32(n, 1000000, "number of add/cancel cycles");
+
+// Each cycle adds a timer for the current coroutine, and cancels it by resuming
+// the coroutine before it expires. It is what co::recv() or co::send() with a
+// timeout does in most cases.
+DEF_main(argc, argv) {
+    auto s = co::next_sched();
+    co::wait_group wg(FLG_c + 1);
+
+    for (uint32 i = 0; i < FLG_c; ++i) {
+        s->go([wg]() {
+            co::sleep(3000 + co::rand() % 3000);
+            wg.done();
+        });
+    }
+
+    s->go([wg]() {
+        co::Timer t;
+        for (uint32 i = 0; i < FLG_n; ++i) {
+            co::add_timer(1000 + (i & 1023));
+            co::resume(co::coroutine());
+            co::yield();
+        }
+        const int64 ns = t.ns();
+        co::print(
+            FLG_n, " add/cancel cycles with ", FLG_c, " idle timers: ",
+            ns / 1000000, " ms, ", ns / FLG_n, " ns per cycle"
+        );
+        wg.done();
+    });
+
+    wg.wait();
+    return 0;
+}
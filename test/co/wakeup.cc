@@ -0,0 +1,30 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_uint32(n, 100000, "number of round trips");
+
+// A thread adds a task to an idle scheduler and waits for it to finish. Each
+// round trip wakes up the scheduler from epoll once.
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    auto s = co::next_sched();
+    co::sync_event ev;
+    int id = -1;
+    s->go([&ev, &id]() { id = co::sched_id(); ev.signal(); });
+    ev.wait();
+
+    co::Timer t;
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        s->go([&ev]() { ev.signal(); });
+        ev.wait();
+    }
+    const int64 ns = t.ns();
+
+    const auto st = co::sched_stats();
+    co::print(
+        FLG_n, " round trips in ", ns / 1000000, " ms, ", ns / FLG_n, " ns per round trip, ",
+        "signals: ", st[id].signals
+    );
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "co/json.h"
+#include "co/cout.h"
+#include "co/flag.h"
+#include "co/mem.h"
+#include "co/rand.h"
+#include "co/time.h"
+#include <thread>
+
+DEC_uint32(mem_huge_page);
+DEC_uint32(mem_max_retained);
+DEF_uint32(n, 200000, "number of objects in the JSON array");
+DEF_uint32(r, 3, "rounds of parsing");
+DEF_uint32(m, 4000000, "number of random lookups in the parsed JSON");
+DEF_bool(hugetlb, false, "also test MAP_HUGETLB, huge pages must be reserved in /proc/sys/vm/nr_hugepages");
+
+// size(KB) of anonymous memory backed by transparent or hugetlb huge pages
+int64 huge_kb() {
+    int64 r = 0;
+#ifdef __linux__
+    const char* keys[] = { "AnonHugePages:", "Private_Hugetlb:" };
+    char line[256];
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        for (auto k : keys) {
+            const size_t n = strlen(k);
+            if (strncmp(line, k, n) == 0) r += atoll(line + n);
+        }
+    }
+    fclose(f);
+#endif
+    return r;
+}
+
+fastring make_text() {
+    co::Json a = json::array();
+    for (uint32 i = 0; i < FLG_n; ++i) {
+        a.push_back(co::Json({
+            { "id", i },
+            { "name", fastring(8 + i % 16, 'x') },
+            { "tags", { 1, 2, 3 } },
+            { "v", i * 0.5 },
+        }));
+    }
+    return a.str();
+}
+
+// parse the text, then look up random elements of the result. It runs in a 
+// new thread, so that memory comes from new large blocks.
+void bench(const fastring& s, uint32 mode) {
+    std::thread([&s, mode]() {
+        FLG_mem_huge_page = mode;
+        const int64 h = huge_kb();
+        co::Timer t;
+        int64 parse_us = 0, lookup_ns = 0;
+        int64 sum = 0;
+        for (uint32 i = 0; i < FLG_r; ++i) {
+            t.restart();
+            co::Json x = json::parse(s.data(), s.size());
+            parse_us += t.us();
+
+            uint32 seed = 1234;
+            t.restart();
+            for (uint32 k = 0; k < FLG_m; ++k) {
+                sum += x[co::rand(seed) % FLG_n]["id"].as_int();
+            }
+            lookup_ns += t.ns();
+        }
+        co::print(
+            "mem_huge_page=", mode, ": parse ", parse_us / 1000 / FLG_r, " ms, lookup ",
+            lookup_ns / FLG_r / FLG_m, " ns, huge pages used: ", (huge_kb() - h) / 1024,
+            " MB", sum == 7 ? " " : ""
+        );
+    }).join();
+}
+
+int main(int argc, char** argv) {
+    flag::parse(argc, argv);
+    FLG_mem_max_retained = 0; // do not reuse blocks between runs
+    const fastring s = make_text();
+    co::print("size of JSON: ", s.size() >> 20, " MB");
+
+    bench(s, 0);
+    bench(s, 1);
+    if (FLG_hugetlb) bench(s, 2);
+    bench(s, 0);
+    return 0;
+}
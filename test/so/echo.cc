@@ -7,12 +7,35 @@ DEF_int32(l, 1024, "message length");
 DEF_int32(t, 10, "test time in seconds");
 DEF_bool(s, false, "run as server if true");
 
+// count the epoll_ctl calls made by the schedulers, to see how many syscalls
+// are spent on registering sockets to epoll.
+static uint64 g_nctl = 0;
+static uint64 g_nreq = 0;
+
+#ifdef __linux__
+#include <dlfcn.h>
+
+struct epoll_event;
+extern "C" int epoll_ctl(int ep, int op, int fd, struct epoll_event* ev) {
+    typedef int (*epoll_ctl_fp_t)(int, int, int, struct epoll_event*);
+    static epoll_ctl_fp_t fp = (epoll_ctl_fp_t) dlsym(RTLD_NEXT, "epoll_ctl");
+    atomic_inc(&g_nctl, mo_relaxed);
+    return fp(ep, op, fd, ev);
+}
+#endif
+
+void print_syscall_count(uint64 nreq) {
+    const uint64 nctl = atomic_load(&g_nctl, mo_relaxed);
+    co::print("epoll_ctl calls: ", nctl, ", per request: ", (nreq ? (double)nctl / nreq : 0.0));
+}
+
 void conn_cb(tcp::Connection conn) {
     fastream buf(FLG_l);
 
     while (true) {
         int r = conn.recvn(&buf[0], FLG_l);
         if (r > 0) {
+            atomic_inc(&g_nreq, mo_relaxed);
             r = conn.send(buf.data(), FLG_l);
             if (r <= 0) {
                 conn.reset(3000);
@@ -32,7 +55,9 @@ bool g_stop = false;
 struct Count {
     uint32 r;
     uint32 s;
-    char x[56];
+    uint64 us;     // total latency of the requests
+    uint64 max_us; // max latency of the requests
+    char x[40];
 };
 Count* g_count;
 co::wait_group g_wg;
@@ -51,7 +76,9 @@ void client_fun(int i) {
     fastring buf(FLG_l, '\0');
     auto& count = g_count[i];
 
+    co::Timer t;
     while (!g_stop) {
+        t.restart();
         int r = c.send(buf.data(), FLG_l);
         if (r <= 0) {
             break;
@@ -66,6 +93,10 @@ void client_fun(int i) {
             break;
         } 
         ++count.r;
+
+        const uint64 us = t.us();
+        count.us += us;
+        if (count.max_us < us) count.max_us = us;
     }
 }
 
@@ -73,12 +104,22 @@ int main(int argc, char** argv) {
     flag::set_value("co_sched_num", "1");
     FLG_help << "usage: \n"
              << "\techo -s            # run echo server\n"
-             << "\techo -c 128 -t 20  # run echo client, 128 connection, 20 seconds\n";
+             << "\techo -c 128 -t 20  # run echo client, 128 connection, 20 seconds\n"
+             << "\techo -co_io_uring  # use io_uring instead of epoll, for both server and client\n";
     flag::parse(argc, argv);
 
     if (FLG_s) {
         tcp::Server().on_connection(conn_cb).start("0.0.0.0", FLG_p);
-        while (true) sleep::sec(1024);
+        uint64 n = 0;
+        while (true) {
+            sleep::sec(FLG_t);
+            const uint64 x = atomic_load(&g_nreq, mo_relaxed);
+            if (x != n) {
+                n = x;
+                co::print("requests: ", n);
+                print_syscall_count(n);
+            }
+        }
     } else {
         g_count = (Count*) co::zalloc(sizeof(Count) * FLG_c);
         g_wg.add(FLG_c);
@@ -93,9 +134,12 @@ int main(int argc, char** argv) {
 
         size_t rsum = 0;
         size_t ssum = 0;
+        uint64 us = 0, max_us = 0;
         for (int i = 0; i < FLG_c; ++i) {
             rsum += g_count[i].r;
             ssum += g_count[i].s;
+            us += g_count[i].us;
+            if (max_us < g_count[i].max_us) max_us = g_count[i].max_us;
         }
 
         co::print("server: ", FLG_h, ":", FLG_p);
@@ -106,6 +150,8 @@ int main(int argc, char** argv) {
         );
         co::print("requests: ", ssum);
         co::print("responses: ", rsum);
+        co::print("avg latency: ", (rsum ? us / rsum : 0), " us, max latency: ", max_us, " us");
+        print_syscall_count(ssum);
     }
 
     return 0;
@@ -1,6 +1,13 @@
 #include "co/unitest.h"
 #include "co/co.h"
 #include "co/cout.h"
+#include "co/time.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace test {
 
@@ -431,6 +438,190 @@ DEF_test(co) {
         v = 0;
     }
 
+    DEF_case(rwmutex) {
+        co::rwmutex m;
+        co::wait_group wg;
+
+        m.lock();
+        EXPECT_EQ(m.try_lock(), false);
+        EXPECT_EQ(m.try_lock_shared(), false);
+        m.unlock();
+        EXPECT_EQ(m.try_lock_shared(), true);
+        EXPECT_EQ(m.try_lock_shared(), true);
+        EXPECT_EQ(m.try_lock(), false);
+        m.unlock_shared();
+        m.unlock_shared();
+        EXPECT_EQ(m.try_lock(), true);
+        m.unlock();
+
+        // readers share the lock
+        {
+            int n = 0;
+            wg.add(2);
+            m.lock_shared();
+            go([wg, m, &n]() {
+                co::shared_lock g(m);
+                ++n;
+                wg.done();
+            });
+            std::thread([wg, m, &n]() {
+                co::shared_lock g(m);
+                atomic_inc(&n);
+                wg.done();
+            }).detach();
+            wg.wait();
+            m.unlock_shared();
+            EXPECT_EQ(n, 2);
+        }
+
+        // a writer waiting blocks readers coming later
+        {
+            int r = -1;
+            wg.add(2);
+            m.lock_shared();
+            go([wg, m, &v]() {
+                co::unique_lock g(m);
+                v = 1;
+                wg.done();
+            });
+            co::sleep(10);
+            EXPECT_EQ(m.try_lock_shared(), false);
+            go([wg, m, &v, &r]() {
+                co::shared_lock g(m);
+                r = v;
+                wg.done();
+            });
+            co::sleep(10);
+            EXPECT_EQ(v, 0);
+            m.unlock_shared();
+            wg.wait();
+            EXPECT_EQ(r, 1);
+            v = 0;
+        }
+
+        // readers and writers in coroutines and threads
+        wg.add(24);
+        int k = 0, bad = 0;
+        for (int i = 0; i < 20; ++i) {
+            go([wg, m, i, &v, &k, &bad]() {
+                for (int j = 0; j < 100; ++j) {
+                    if ((i + j) % 4 == 0) {
+                        co::unique_lock g(m);
+                        ++v;
+                        ++k;
+                    } else {
+                        co::shared_lock g(m);
+                        if (v != k) atomic_inc(&bad);
+                    }
+                }
+                wg.done();
+            });
+        }
+        for (int i = 0; i < 4; ++i) {
+            std::thread([wg, m, i, &v, &k, &bad]() {
+                for (int j = 0; j < 100; ++j) {
+                    if ((i + j) % 4 == 0) {
+                        co::unique_lock g(m);
+                        ++v;
+                        ++k;
+                    } else {
+                        co::shared_lock g(m);
+                        if (v != k) atomic_inc(&bad);
+                    }
+                }
+                wg.done();
+            }).detach();
+        }
+        wg.wait();
+        EXPECT_EQ(v, 600);
+        EXPECT_EQ(k, 600);
+        EXPECT_EQ(bad, 0);
+        v = 0;
+    }
+
+    DEF_case(semaphore) {
+        co::semaphore sem(3);
+        EXPECT_EQ(sem.available(), 3);
+        EXPECT(sem.try_acquire(2));
+        EXPECT(!sem.try_acquire(2));
+        EXPECT(sem.try_acquire());
+        EXPECT(!sem.acquire(1, 10));
+        sem.release(3);
+        EXPECT_EQ(sem.available(), 3);
+
+        // waiters get permits in order
+        {
+            int r = 0;
+            co::wait_group wg(2);
+            sem.acquire(3);
+            go([wg, sem, &r]() {
+                sem.acquire(2);
+                r = r * 10 + 1;
+                sem.release(2);
+                wg.done();
+            });
+            co::sleep(10);
+            go([wg, sem, &r]() {
+                sem.acquire(1);
+                r = r * 10 + 2;
+                sem.release(1);
+                wg.done();
+            });
+            co::sleep(10);
+            sem.release(1); // not enough for the first waiter
+            co::sleep(10);
+            EXPECT_EQ(r, 0);
+            sem.release(2);
+            wg.wait();
+            EXPECT_EQ(r, 12);
+            EXPECT_EQ(sem.available(), 3);
+        }
+
+        // a waiter timed out does not block the others
+        {
+            bool r1 = true, r2 = false;
+            co::wait_group wg(2);
+            sem.acquire(3);
+            go([wg, sem, &r1]() {
+                r1 = sem.acquire(3, 10);
+                wg.done();
+            });
+            std::thread([wg, sem, &r2]() {
+                r2 = sem.acquire(1, 3000);
+                if (r2) sem.release(1);
+                wg.done();
+            }).detach();
+            co::sleep(50);
+            sem.release(1);
+            wg.wait();
+            EXPECT(!r1);
+            EXPECT(r2);
+            sem.release(2);
+            EXPECT_EQ(sem.available(), 3);
+        }
+
+        // limit the concurrency
+        {
+            int n = 0, max = 0;
+            co::wait_group wg(32);
+            for (int i = 0; i < 32; ++i) {
+                go([wg, sem, &n, &max]() {
+                    {
+                        co::semaphore_guard g(sem);
+                        const int x = atomic_inc(&n);
+                        if (x > atomic_load(&max)) atomic_store(&max, x);
+                        co::sleep(1);
+                        atomic_dec(&n);
+                    }
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT_LE(max, 3);
+            EXPECT_EQ(sem.available(), 3);
+        }
+    }
+
     DEF_case(event) {
         {
             co::event ev;
@@ -777,11 +968,243 @@ DEF_test(co) {
             EXPECT_EQ(i, 6);
         }
 
+        {
+            // many writers and readers, elements pass through the ring buffer 
+            // or are handed over to the waiters
+            for (uint32 cap : { 1, 3, 8 }) {
+                co::chan<int> ch(cap);
+                co::wait_group wg(8);
+                int64 sum[4] = { 0 };
+                for (int i = 0; i < 4; ++i) {
+                    go([ch, wg]() {
+                        for (int k = 1; k <= 1000; ++k) ch << k;
+                        wg.done();
+                    });
+                    go([ch, wg, &sum, i]() {
+                        int x = 0;
+                        for (int k = 0; k < 1000; ++k) { ch >> x; sum[i] += x; }
+                        wg.done();
+                    });
+                }
+                wg.wait();
+                EXPECT_EQ(sum[0] + sum[1] + sum[2] + sum[3], 4 * 500500);
+            }
+        }
+
+        {
+            // readers waiting with a timeout race with fast path readers in 
+            // threads, a waiter that loses an element must still time out
+            co::chan<int> ch(1, 5);
+            co::wait_group wg(5);
+            bool stop = false;
+            int64 n[5] = { 0 };
+            uint32 w = 0;
+            auto f = [ch, wg, &stop, &n](int i) {
+                int x = 0;
+                for (;;) {
+                    ch >> x;
+                    if (ch.done()) { ++n[i]; continue; }
+                    if (atomic_load(&stop)) break;
+                }
+                wg.done();
+            };
+            go([f]() { f(0); });
+            go([f]() { f(1); });
+            std::thread t1(f, 2), t2(f, 3);
+            go([ch, wg, &stop, &w]() {
+                for (int k = 0; k < 3000; ++k) {
+                    ch << k;
+                    if (ch.done()) ++w;
+                    if ((k & 63) == 0) co::sleep(1);
+                }
+                atomic_store(&stop, true);
+                wg.done();
+            });
+            wg.wait();
+            t1.join();
+            t2.join();
+            EXPECT_EQ(n[0] + n[1] + n[2] + n[3], (int64)w);
+        }
+
+        {
+            // closed by threads and coroutines at the same time, each close() 
+            // returns after the channel is closed, readers waiting are woken up
+            co::chan<int> ch1(1, 10), ch2(1);
+            int x = 0;
+            ch1 >> x; // times out, the waiter is freed by close()
+            EXPECT(!ch1.done());
+
+            co::wait_group wg(5);
+            bool rd = true;
+            bool c[4] = { false };
+            go([ch2, wg, &rd]() {
+                int v = 0;
+                ch2 >> v;
+                rd = ch2.done();
+                wg.done();
+            });
+            co::sleep(10);
+            auto f = [ch1, ch2, wg, &c](int i) {
+                ch1.close();
+                ch2.close();
+                c[i] = !ch1 && !ch2;
+                wg.done();
+            };
+            go([f]() { f(0); });
+            go([f]() { f(1); });
+            std::thread t1(f, 2), t2(f, 3);
+            wg.wait();
+            t1.join();
+            t2.join();
+            EXPECT(!rd);
+            EXPECT(c[0] && c[1] && c[2] && c[3]);
+        }
+
         EXPECT_NE(gc, 0);
         EXPECT_NE(gd, 0);
         EXPECT_EQ(gc, gd);
     }
 
+    DEF_case(chan_n) {
+        {
+            co::chan<int> ch(8);
+            int a[5] = { 1, 2, 3, 4, 5 };
+            int b[8] = { 0 };
+            EXPECT_EQ(ch.write_n(a, 5), 5);
+            EXPECT(ch.done());
+            EXPECT_EQ(ch.read_n(b, 8), 5);
+            EXPECT(ch.done());
+            EXPECT_EQ(b[0], 1);
+            EXPECT_EQ(b[4], 5);
+            EXPECT_EQ(ch.write_n(a, 5), 5);
+            EXPECT_EQ(ch.read_n(b, 2), 2);
+            EXPECT_EQ(b[1], 2);
+            EXPECT_EQ(ch.read_n(b, 8), 3);
+            EXPECT_EQ(b[0], 3);
+        }
+
+        {
+            // write more than the capacity, the writer waits for the reader
+            co::chan<fastring> ch(3);
+            co::vector<fastring> a(10, 0), b(10, 0);
+            for (int i = 0; i < 10; ++i) a[i].append((char)('0' + i));
+            size_t r = 0, w = 0;
+            co::wait_group wg(2);
+            go([wg, ch, &a, &w]() {
+                w = ch.write_n(a.data(), a.size());
+                wg.done();
+            });
+            go([wg, ch, &b, &r]() {
+                while (r < b.size()) {
+                    const size_t n = ch.read_n(b.data() + r, b.size() - r);
+                    if (n == 0) break;
+                    r += n;
+                }
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(w, 10);
+            EXPECT_EQ(r, 10);
+            EXPECT_EQ(b[0], "0");
+            EXPECT_EQ(b[9], "9");
+        }
+
+        {
+            // timeout and close
+            co::chan<int> ch(2, 10);
+            int a[4] = { 1, 2, 3, 4 };
+            EXPECT_EQ(ch.write_n(a, 4), 2);
+            EXPECT(!ch.done());
+            EXPECT_EQ(ch.read_n(a, 4), 2);
+            EXPECT_EQ(ch.read_n(a, 4), 0);
+            EXPECT(!ch.done());
+            ch.close();
+            EXPECT_EQ(ch.write_n(a, 1), 0);
+            EXPECT_EQ(ch.read_n(a, 4), 0);
+        }
+    }
+
+    DEF_case(select) {
+        co::chan<int> ch1(1), ch2(1);
+        int x = 0;
+        {
+            ch2 << 7;
+            EXPECT_EQ(co::select({ ch1.read_case(x), ch2.read_case(x) }, 0), 1);
+            EXPECT(ch2.done());
+            EXPECT_EQ(x, 7);
+            EXPECT_EQ(co::select({ ch1.read_case(x), ch2.read_case(x) }, 0), -1);
+            EXPECT(!ch2.done());
+            EXPECT_EQ(co::select({ ch1.read_case(x), ch2.read_case(x) }, 10), -1);
+        }
+
+        {
+            // wait in a coroutine, the element is read to its stack
+            int r = -2, y = 0;
+            fastring s;
+            co::chan<fastring> ch3(1);
+            co::wait_group wg(2);
+            go([wg, ch1, ch3, &r, &s]() {
+                int a = 0;
+                fastring v;
+                r = co::select({ ch1.read_case(a), ch3.read_case(v) }, 3000);
+                s = v;
+                wg.done();
+            });
+            go([wg, ch3]() {
+                co::sleep(10);
+                ch3 << fastring("hello");
+                wg.done();
+            });
+            wg.wait();
+            EXPECT_EQ(r, 1);
+            EXPECT_EQ(s, "hello");
+
+            // the case not chosen takes no effect
+            ch1 << 3;
+            ch1 >> y;
+            EXPECT_EQ(y, 3);
+        }
+
+        {
+            // wait for writing in a thread, the channel is full
+            ch1 << 1;
+            int r = -2;
+            std::thread t([ch1, &r]() {
+                r = co::select({ ch1.write_case(2) }, 3000);
+            });
+            co::wait_group wg(1);
+            go([wg, ch1]() {
+                co::sleep(10);
+                int v = 0;
+                ch1 >> v;
+                wg.done();
+            });
+            wg.wait();
+            t.join();
+            EXPECT_EQ(r, 0);
+            ch1 >> x;
+            EXPECT_EQ(x, 2);
+        }
+
+        {
+            // a closed channel is ready for reading
+            co::chan<int> ch(1);
+            int r = -2;
+            bool done = true;
+            co::wait_group wg(1);
+            go([wg, ch, ch2, &r, &done]() {
+                int a = 0, b = 0;
+                r = co::select({ ch2.read_case(a), ch.read_case(b) });
+                done = ch.done();
+                wg.done();
+            });
+            go([ch]() { co::sleep(10); ch.close(); });
+            wg.wait();
+            EXPECT_EQ(r, 1);
+            EXPECT(!done);
+        }
+    }
+
     DEF_case(pool) {
         co::pool p(
             []() { return (void*) co::make<int>(0); },
@@ -823,6 +1246,269 @@ DEF_test(co) {
 
         p.clear();
     }
+
+    DEF_case(pool_shared) {
+        int live = 0;
+        co::pool p(
+            [&live]() { atomic_inc(&live); return (void*) co::make<int>(0); },
+            [&live](void* p) { atomic_dec(&live); co::del((int*)p); },
+            2
+        );
+        p.set_shared_cap(2);
+
+        // 2 in the pool of the scheduler, 2 in the shared pool, 1 destroyed
+        co::pool_stats st;
+        size_t size = 0;
+        co::wait_group wg(1);
+        go([wg, p, &size]() {
+            int* x[5];
+            for (int i = 0; i < 5; ++i) x[i] = (int*) p.pop();
+            for (int i = 0; i < 5; ++i) p.push(x[i]);
+            size = p.size();
+            for (int i = 0; i < 5; ++i) x[i] = (int*) p.pop();
+            for (int i = 0; i < 5; ++i) p.push(x[i]);
+            wg.done();
+        });
+        wg.wait();
+        st = p.stats();
+        EXPECT_EQ(size, 2);
+        EXPECT_EQ(live, 4);
+        EXPECT_EQ(st.hits, 4);
+        EXPECT_EQ(st.borrows, 2);
+        EXPECT_EQ(st.misses, 6);
+        EXPECT_EQ(st.creates, 6);
+
+        // elements fail the health check are destroyed
+        p.set_health_check([](void* e) { return *(int*)e == 0; });
+        int r = -1;
+        wg.add(1);
+        go([wg, p, &r]() {
+            int* x = (int*) p.pop();
+            *x = 1;
+            p.push(x);
+            x = (int*) p.pop();
+            r = *x;
+            p.push(x);
+            wg.done();
+        });
+        wg.wait();
+        st = p.stats();
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(st.drops, 1);
+        EXPECT_EQ(live, 3);
+
+        // elements idle for too long are destroyed, those pushed before the 
+        // timeout is set are evicted at once
+        p.set_idle_timeout(10);
+        wg.add(1);
+        go([wg, p]() {
+            int* x = (int*) p.pop();
+            p.push(x);
+            wg.done();
+        });
+        wg.wait();
+        co::sleep(30);
+        p.evict();
+        st = p.stats();
+        EXPECT_EQ(live, 0);
+        EXPECT_EQ(st.evicts, 4);
+        p.clear();
+
+        // a pool without capacity keeps its share of the shared capacity, and 
+        // elements beyond that go to the shared pool
+        co::pool q(
+            [&live]() { atomic_inc(&live); return (void*) co::make<int>(0); },
+            [&live](void* p) { atomic_dec(&live); co::del((int*)p); }
+        );
+        q.set_shared_cap(4 * co::sched_num());
+        wg.add(1);
+        go([wg, q, &size]() {
+            int* x[6];
+            for (int i = 0; i < 6; ++i) x[i] = (int*) q.pop();
+            for (int i = 0; i < 6; ++i) q.push(x[i]);
+            size = q.size();
+            for (int i = 0; i < 6; ++i) x[i] = (int*) q.pop();
+            for (int i = 0; i < 6; ++i) q.push(x[i]);
+            wg.done();
+        });
+        wg.wait();
+        st = q.stats();
+        EXPECT_EQ(size, 4);
+        EXPECT_EQ(live, 6);
+        EXPECT_EQ(st.borrows, 2);
+        q.clear();
+        EXPECT_EQ(live, 0);
+    }
+
+    DEF_case(go_batch) {
+        const int n = 1000;
+        co::wait_group wg(n);
+        co::vector<co::Closure*> cbs(n);
+        for (int i = 0; i < n; ++i) {
+            cbs.push_back(co::new_closure([wg, &v]() {
+                atomic_inc(&v, mo_relaxed);
+                wg.done();
+            }));
+        }
+        co::go_batch(cbs);
+        wg.wait();
+        EXPECT_EQ(v, n);
+        v = 0;
+
+        wg.add(3);
+        cbs.clear();
+        for (int i = 0; i < 3; ++i) {
+            cbs.push_back(co::new_closure([wg, &v, i]() {
+                v = v * 10 + i + 1;
+                wg.done();
+            }));
+        }
+        co::next_sched()->go_batch(cbs);
+        wg.wait();
+        EXPECT_EQ(v, 123); // tasks start in order in a scheduler
+        v = 0;
+    }
+
+    DEF_case(go_high) {
+        auto s = co::next_sched();
+        co::vector<int> order(64);
+        co::wait_group wg(34);
+        const auto a = co::sched_stats();
+        s->go([&order, wg, s]() {
+            for (int i = 0; i < 32; ++i) {
+                s->go([&order, wg, i]() { order.push_back(i); wg.done(); });
+            }
+            s->go_high([&order, wg]() {
+                order.push_back(-1);
+                co::resume(co::coroutine()); // back to the high priority lane
+                co::yield();
+                order.push_back(-2);
+                wg.done();
+            });
+            wg.done();
+        });
+        wg.wait();
+
+        // the high lane is drained first, and checked again after 16 normal tasks
+        EXPECT_EQ(order.size(), 34);
+        EXPECT_EQ(order[0], -1);
+        EXPECT_EQ(order[1], 0);
+        EXPECT_EQ(order[17], -2);
+        EXPECT_EQ(order.back(), 31);
+        const auto b = co::sched_stats();
+        uint64 x = 0;
+        for (size_t i = 0; i < a.size(); ++i) x += b[i].high_switches - a[i].high_switches;
+        EXPECT_EQ(x, 2);
+    }
+
+  #ifdef __linux__
+    DEF_case(io_event) {
+        // the socket stays readable, each wait returns at once though the data 
+        // is not read, as the event is checked before the coroutine waits
+        int fds[2];
+        EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+        EXPECT_EQ(::write(fds[1], "x", 1), 1);
+        bool r[2] = { false, false };
+        co::wait_group wg(1);
+        go([wg, &fds, &r]() {
+            for (int i = 0; i < 2; ++i) {
+                co::add_io_event(fds[0], co::ev_read);
+                co::add_timer(1000);
+                co::yield();
+                r[i] = !co::timeout();
+                co::del_io_event(fds[0], co::ev_read);
+            }
+            co::close(fds[0]);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        co::close(fds[1]);
+
+        // an fd closed outside the hook leaves stale epoll state, a socket that 
+        // reuses its number must still be added to epoll
+        bool x[2] = { false, false }, reused[2] = { false, false };
+        wg.add(1);
+        go([wg, &x, &reused]() {
+            int a[2], b[2];
+            char c;
+            for (int i = 0; i < 2; ++i) {
+                ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, a);
+                co::add_io_event(a[0], co::ev_read);
+                co::add_timer(1);
+                co::yield();
+                co::del_io_event(a[0], co::ev_read);
+                syscall(SYS_close, a[0]);
+                syscall(SYS_close, a[1]);
+
+                // the first time, the socket is created outside the hook too,
+                // the second time, by the hooked socketpair()
+                if (i == 0) {
+                    syscall(SYS_socketpair, AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, b);
+                } else {
+                    ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, b);
+                }
+                reused[i] = b[0] == a[0];
+                go([b]() { co::sleep(10); ::write(b[1], "x", 1); });
+                if (i == 0) {
+                    co::add_io_event(b[0], co::ev_read);
+                    co::add_timer(1000);
+                    co::yield();
+                    x[i] = !co::timeout();
+                    co::del_io_event(b[0], co::ev_read);
+                } else {
+                    x[i] = co::recv(b[0], &c, 1, 1000) == 1;
+                }
+                co::sleep(20);
+                co::close(b[0]);
+                co::close(b[1]);
+            }
+            wg.done();
+        });
+        wg.wait();
+        EXPECT(reused[0]);
+        EXPECT(reused[1]);
+        EXPECT(x[0]);
+        EXPECT(x[1]);
+    }
+  #endif
+
+    DEF_case(maybe_yield) {
+        auto s = co::next_sched();
+        int x = 0;
+        int64 ms = 0;
+        co::wait_group wg(2);
+        s->go([&x, &ms, wg, s]() {
+            s->go([&x, wg]() { x = 1; wg.done(); });
+            // the new coroutine runs only after this one yields
+            const int64 beg = now::ms();
+            while (x == 0 && (ms = now::ms() - beg) < 3000) co::maybe_yield();
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(x, 1);
+        EXPECT_LT(ms, 3000);
+    }
+
+    DEF_case(sched_stats) {
+        const auto a = co::sched_stats();
+        EXPECT_EQ(a.size(), co::sched_num());
+
+        int id = -1;
+        co::wait_group wg(1);
+        go([wg, &id]() {
+            id = co::sched_id();
+            co::sleep(1);
+            wg.done();
+        });
+        wg.wait();
+
+        const auto b = co::sched_stats();
+        EXPECT_EQ(b[id].id, id);
+        EXPECT_GE(b[id].switches, a[id].switches + 2);
+        EXPECT_GE(b[id].timers, a[id].timers + 1);
+    }
 }
 
 } // test
@@ -1,5 +1,11 @@
 #include "co/unitest.h"
 #include "co/mem.h"
+#include "co/json.h"
+#include "co/time.h"
+#include <map>
+#include <set>
+#include <vector>
+#include <thread>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -10,6 +16,9 @@
 #endif
 
 
+DEC_uint32(mem_decay_ms);
+DEC_uint32(mem_huge_page);
+
 namespace test {
 namespace mem {
 
@@ -387,6 +396,211 @@ DEF_test(mem) {
         EXPECT_EQ(a.ref_count(), 0);
         EXPECT_EQ(gd, 2);
     }
+
+    DEF_case(stats) {
+        const size_t L = (size_t)1 << (__arch64 ? 21 : 20); // size of large block
+        auto all = []() {
+            std::map<uint32, co::mem_stat> m;
+            co::mem_stats([&m](uint32 id, const co::mem_stat& s) { m[id] = s; });
+            return m;
+        };
+
+        // find the allocator of a thread by the change of its stats. The thread 
+        // may adopt an allocator of an exited thread, allocate and free first, 
+        // so that the blocks needed are there before the baseline is taken.
+        void *p = 0, *q = 0;
+        uint32 id = (uint32)-1;
+        co::mem_stat s0, s;
+        std::thread([&]() {
+            co::free(co::alloc(100), 100);
+            co::free(co::alloc(5000), 5000);
+            auto m0 = all();
+            p = co::alloc(100);
+            q = co::alloc(5000);
+            for (auto& x : all()) {
+                const auto& a = m0[x.first];
+                const auto& b = x.second;
+                if (b.small_in_use == a.small_in_use + 112 && b.large_in_use == a.large_in_use + 8192) {
+                    id = x.first; s0 = a; s = b;
+                }
+            }
+        }).join();
+
+        EXPECT_NE(id, (uint32)-1);
+        EXPECT_GE(s0.small_blocks, 1);
+        EXPECT_GE(s0.large_blocks, 1);
+        EXPECT_EQ(s.small_blocks, s0.small_blocks);
+        EXPECT_EQ(s.large_blocks, s0.large_blocks);
+        EXPECT_EQ(s.small_in_use, s0.small_in_use + 112);
+        EXPECT_EQ(s.large_in_use, s0.large_in_use + 8192);
+        EXPECT_EQ(s.in_use, s0.in_use + 112 + 8192);
+        EXPECT_EQ(s.committed, s0.committed);
+        EXPECT_GE(s.committed, 2 * L);
+        EXPECT_EQ(s.xfree_pending, 0);
+
+        // free from another thread, it is counted by the thread that frees 
+        // the memory, and subtracted from the process totals
+        auto g0 = co::mem_stats();
+        co::free(p, 100);
+        co::free(q, 5000);
+        auto g = co::mem_stats();
+        auto x = all()[id];
+        EXPECT_EQ(x.small_in_use, s.small_in_use);
+        EXPECT_EQ(x.xfree_pending, 0);
+        EXPECT_EQ(g.small_in_use, g0.small_in_use - 112);
+        EXPECT_EQ(g.large_in_use, g0.large_in_use - 8192);
+        EXPECT_EQ(g.xfree_pending, g0.xfree_pending + 2);
+
+        // allocations > 128K are passed to ::malloc
+        g0 = co::mem_stats();
+        p = co::alloc(256 * 1024);
+        g = co::mem_stats();
+        EXPECT_EQ(g.sys_allocs, g0.sys_allocs + 1);
+        EXPECT_EQ(g.sys_in_use, g0.sys_in_use + 256 * 1024);
+        EXPECT_GE(g.reserved, g.committed);
+        EXPECT_GE(g.in_use, g.sys_in_use);
+        co::free(p, 256 * 1024);
+        g = co::mem_stats();
+        EXPECT_EQ(g.sys_in_use, g0.sys_in_use);
+
+        json::Json j = json::parse(co::mem_stats_json());
+        EXPECT(j.has_member("reserved"));
+        EXPECT(j.has_member("small_occupancy"));
+        EXPECT(j["threads"].is_array());
+        EXPECT_GE(j["threads"].array_size(), 2);
+    }
+
+    DEF_case(thread_exit) {
+        // allocators of exited threads are adopted by new threads
+        auto count = []() {
+            size_t n = 0;
+            co::mem_stats([&n](uint32, const co::mem_stat&) { ++n; });
+            return n;
+        };
+        std::thread([]() { co::free(co::alloc(32), 32); }).join();
+        const size_t n = count();
+        for (int i = 0; i < 8; ++i) {
+            std::thread([]() { co::free(co::alloc(32), 32); }).join();
+        }
+        EXPECT_EQ(count(), n);
+
+        // a thread_local object created before the first allocation of the 
+        // thread is destroyed after the allocator was given back, the allocator 
+        // adopted by its destructor is given back again
+        struct X {
+            ~X() { co::free(co::alloc(32), 32); }
+        };
+        for (int i = 0; i < 8; ++i) {
+            std::thread([]() {
+                static thread_local X x;
+                (void)x;
+                co::free(co::alloc(32), 32);
+            }).join();
+        }
+        EXPECT_EQ(count(), n);
+    }
+
+    DEF_case(scavenge) {
+        const uint32 decay = FLG_mem_decay_ms;
+        FLG_mem_decay_ms = 60 * 1000;
+
+        // free large blocks are retained for reuse
+        void* v[64];
+        const auto s0 = co::mem_stats();
+        for (int i = 0; i < 64; ++i) v[i] = co::alloc(100 * 1024);
+        for (int i = 0; i < 64; ++i) co::free(v[i], 100 * 1024);
+        auto s = co::mem_stats();
+        EXPECT_GT(s.retained, s0.retained);
+        EXPECT_GE(s.committed, s.retained);
+
+        // and returned to the OS when they are idle for too long
+        FLG_mem_decay_ms = 1;
+        sleep::ms(10);
+        co::mem_scavenge();
+        s = co::mem_stats();
+        EXPECT_EQ(s.retained, 0);
+
+        // the background scavenger does it without co::mem_scavenge()
+        FLG_mem_decay_ms = 60 * 1000;
+        for (int i = 0; i < 64; ++i) v[i] = co::alloc(100 * 1024);
+        for (int i = 0; i < 64; ++i) co::free(v[i], 100 * 1024);
+        EXPECT_GT(co::mem_stats().retained, 0);
+        FLG_mem_decay_ms = 1;
+        for (int i = 0; i < 30 && co::mem_stats().retained > 0; ++i) sleep::ms(100);
+        EXPECT_EQ(co::mem_stats().retained, 0);
+        FLG_mem_decay_ms = decay;
+    }
+
+    DEF_case(reuse) {
+        // a free large block retained by a large alloc is reused for small 
+        // allocs, stale data in it must not be taken as allocator metadata.
+        const uint32 decay = FLG_mem_decay_ms;
+        FLG_mem_decay_ms = 60 * 1000;
+        size_t dup = 0, bad = 0;
+        std::thread([&dup, &bad]() {
+            void* v[64];
+            for (int i = 0; i < 64; ++i) {
+                v[i] = co::alloc(100 * 1024);
+                memset(v[i], 0xff, 100 * 1024);
+            }
+            for (int i = 0; i < 64; ++i) co::free(v[i], 100 * 1024);
+
+            std::set<void*> s;
+            std::vector<uint32*> p(4000);
+            for (size_t i = 0; i < p.size(); ++i) {
+                p[i] = (uint32*) co::alloc(64);
+                if (!s.insert(p[i]).second) ++dup;
+                *p[i] = (uint32)i;
+            }
+            for (size_t i = 0; i < p.size(); ++i) {
+                if (*p[i] != (uint32)i) ++bad;
+                co::free(p[i], 64);
+            }
+        }).join();
+        EXPECT_EQ(dup, 0);
+        EXPECT_EQ(bad, 0);
+        FLG_mem_decay_ms = decay;
+    }
+
+    DEF_case(huge_page) {
+        // memory is usable in all modes, MAP_HUGETLB falls back to normal 
+        // pages if no huge page is reserved.
+        const uint32 hp = FLG_mem_huge_page;
+        const uint32 decay = FLG_mem_decay_ms;
+        FLG_mem_decay_ms = 60 * 1000;
+        auto f = [](uint32 mode, bool& ok) {
+            FLG_mem_huge_page = mode;
+            void* v[32];
+            for (int i = 0; i < 32; ++i) {
+                v[i] = co::alloc(100 * 1024);
+                memset(v[i], i, 100 * 1024);
+            }
+            for (int i = 0; i < 32; ++i) {
+                if (((char*)v[i])[100 * 1024 - 1] != (char)i) ok = false;
+                co::free(v[i], 100 * 1024);
+            }
+        };
+        for (uint32 mode = 0; mode <= 2; ++mode) {
+            bool ok = true;
+            std::thread(f, mode, std::ref(ok)).join();
+            EXPECT(ok);
+        }
+
+        // the mode may change at runtime, blocks retained are returned to the 
+        // OS the way they were committed, and they are usable when committed again
+        FLG_mem_huge_page = 0;
+        FLG_mem_decay_ms = 1;
+        sleep::ms(10);
+        co::mem_scavenge();
+        EXPECT_EQ(co::mem_stats().retained, 0);
+        for (uint32 mode = 2; mode <= 2; --mode) {
+            bool ok = true;
+            std::thread(f, mode, std::ref(ok)).join();
+            EXPECT(ok);
+        }
+        FLG_mem_decay_ms = decay;
+        FLG_mem_huge_page = hp;
+    }
 }
 
 } // namespace test
@@ -1,5 +1,6 @@
 #include "co/unitest.h"
 #include "co/os.h"
+#include <thread>
 
 namespace test {
 
@@ -36,6 +37,24 @@ DEF_test(os) {
     DEF_case(cpunum) {
         EXPECT_GT(os::cpunum(), 0);
     }
+
+    DEF_case(cpus) {
+        const auto& v = os::cpus();
+        EXPECT(!v.empty());
+        EXPECT_GE(os::numa_nodes(), 1);
+        for (size_t i = 0; i < v.size(); ++i) {
+            EXPECT_GE(v[i].core, 0);
+            EXPECT_LT(v[i].node, os::numa_nodes());
+            if (i > 0) EXPECT_GT(v[i].id, v[i - 1].id);
+        }
+
+      #ifdef __linux__
+        bool r = false;
+        const int cpu = v.back().id;
+        std::thread([&r, cpu]() { r = os::bind_cpu(cpu); }).join();
+        EXPECT(r);
+      #endif
+    }
 }
 
 } // namespace test